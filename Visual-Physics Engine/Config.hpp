@@ -42,11 +42,12 @@ namespace config {
 
     namespace function {
         constexpr sf::Color color = sf::Color::Green;
-        constexpr int coarseSteps = 1000;
-        constexpr int cutoff = 1e3;
-        constexpr float deltaMaxPercent = 0.02f;
-        constexpr int maxDepth = 20;
-        constexpr float deltaMinMultiplier = 2.0f;
+        constexpr sf::Color derivativeColor = sf::Color::Cyan;
+        constexpr float coarseSamplesPerPixel = 0.125f; // Coarse grid of the sweep, adaptivePlot refines in between
+        constexpr int maxDepth = 20; // Safety net, interval bounds end the subdivision long before
+        constexpr float tolerance = 0.5f; // Largest distance in pixels between a drawn chord and the curve
+        constexpr std::size_t maxCurvatureGrowth = 8; // Second derivatives larger than this times the function are not used
+        constexpr int boundarySteps = 20; // Bisection steps to locate a piecewise boundary
     }
 }
 
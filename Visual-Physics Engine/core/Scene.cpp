@@ -7,12 +7,42 @@
 
 #include "Scene.hpp"
 
+#include <algorithm>
 #include <print>
+#include <unordered_set>
 
 #include "../Config.hpp"
 #include "EventHandler.hpp"
 #include "Application.hpp"
 #include "ThreadManager.hpp"
+#include "../math/StaticExpression.hpp"
+
+
+namespace {
+    
+    // Built-in scene expressions, compiled into the binary instead of parsed at startup
+    namespace f {
+        constexpr sx::Variable<0> x;
+        constexpr sx::Variable<1> t;
+        
+        constexpr auto expression = sin(x * sin(t));
+    }
+    
+    namespace g {
+        constexpr sx::Variable<0> a;
+        constexpr sx::Variable<1> b;
+        constexpr sx::Variable<2> t;
+        
+        constexpr auto expression = a * cos(t) * sin(b * t);
+    }
+    
+    // Calls through any chain of dependencies, a definition calling itself would never be up to date
+    bool calls(const CompiledExpression& expression, std::string_view name) {
+        return std::any_of(expression.dependencies.begin(), expression.dependencies.end(), [&](const auto& dependency) {
+            return dependency->header->name == name || calls(*dependency, name);
+        });
+    }
+}
 
 Scene::Scene(sf::Font& font, sf::Clock& clock, Application& application) :
                                      m_translationVector({0, 0}),
@@ -38,25 +68,172 @@ void Scene::draw(sf::RenderTarget& target, sf::RenderStates states) const {
 void Scene::initialize() {
     m_shapes.clear();
     m_functions.clear();
+    m_parser.getSymbols() = SymbolTable();
     
-    m_functions.push_back(std::make_shared<Function>("f", "f(x, t) = sin(x * sin(t))", *this, m_threadManager, sf::Color::Green));
+    m_functions.push_back(std::make_shared<Function>("f", sx::define<f::expression>({"x", "t"}), *this, m_threadManager, sf::Color::Green));
     m_functions.back()->setFlag(Function::Flag::TimeDependent |
                                 Function::Flag::Animated |
                                 Function::Flag::NoParameters |
                                 Function::Flag::IntervalCalculated);
     m_functions.back()->initializeEnvironment();
+    m_parser.getSymbols().defineFunction("f", m_functions.back()->getCompiled());
     
-    m_functions.push_back(std::make_shared<Function>("g", "g(a, b, t) = a * cos(t) * sin(b * t)", *this, m_threadManager, sf::Color::Red));
+    m_functions.push_back(std::make_shared<Function>("g", sx::define<g::expression>({"a", "b", "t"}), *this, m_threadManager, sf::Color::Red));
     m_functions.back()->setFlag(Function::Flag::Animated |
                                 Function::Flag::Waveform |
                                 Function::Flag::TimeDependent);
     m_functions.back()->initializeEnvironment();
+    m_parser.getSymbols().defineFunction("g", m_functions.back()->getCompiled());
     
     m_application.refreshParameterHUDs();
     
     m_coordinateSystem.update();
 }
 
+void Scene::addFunctions(std::span<const std::string> expressions, sf::Color color) {
+    
+    auto results = ExpressionCache::instance().getAll(expressions, m_threadManager);
+    
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        
+        try {
+            
+            // The cache only knows the builtins, calls of scene functions are compiled with the scene symbols
+            if (results[i]) {
+                addFunction(*results[i], color);
+            } else {
+                addFunction(CompiledExpression::parse(expressions[i], m_parser), color);
+            }
+            
+        } catch (const std::exception& e) {
+            std::print(stderr, "Error parsing function '{}': {}\n", expressions[i], e.what());
+        }
+    }
+    
+    m_application.refreshParameterHUDs();
+}
+
+std::shared_ptr<Function> Scene::defineFunction(const std::string& expression, sf::Color color) {
+    
+    auto function = addFunction(CompiledExpression::parse(expression, m_parser), color);
+    
+    m_application.refreshParameterHUDs();
+    
+    return function;
+}
+
+std::shared_ptr<Function> Scene::addDerivative(const std::string& name, const std::string& variable, sf::Color color) {
+    
+    auto symbol = m_parser.getSymbols().find(name);
+    
+    if (!symbol || !symbol->function) {
+        throw std::runtime_error("Unknown function: " + name);
+    }
+    
+    auto derivative = addFunction(CompiledExpression::derive(symbol->function, variable), color);
+    
+    // Plotted over the same variable as the function, e.g. as a waveform over t
+    for (auto& function : m_functions) {
+        if (function->getName() == name) {
+            derivative->setFlag(function->getFlags());
+        }
+    }
+    
+    m_application.refreshParameterHUDs();
+    
+    return derivative;
+}
+
+std::shared_ptr<Function> Scene::addFunction(std::shared_ptr<const CompiledExpression> compiled, sf::Color color) {
+    
+    std::string name(compiled->header->name);
+    
+    if (calls(*compiled, name)) {
+        throw std::runtime_error("Function " + name + " calls itself through another function");
+    }
+    
+    m_parser.getSymbols().defineFunction(name, compiled);
+    
+    for (auto& function : m_functions) {
+        
+        if (function->getName() == name) {
+            
+            function->setCompiled(std::move(compiled));
+            recompileDependents();
+            
+            return function;
+        }
+    }
+    
+    m_functions.push_back(std::make_shared<Function>(name, std::move(compiled), *this, m_threadManager, color));
+    m_functions.back()->setFlag(Function::Flag::IntervalCalculated);
+    m_functions.back()->initializeEnvironment();
+    
+    return m_functions.back();
+}
+
+void Scene::recompileDependents() {
+    
+    SymbolTable& symbols = m_parser.getSymbols();
+    
+    // Compiled against a callee that is no longer the one in the symbol table
+    auto stale = [&](const CompiledExpression& expression) {
+        return std::any_of(expression.dependencies.begin(), expression.dependencies.end(), [&](const auto& dependency) {
+            auto symbol = symbols.find(dependency->header->name);
+            return !symbol || symbol->function != dependency;
+        });
+    };
+    
+    // A derivative has no source to parse, it is taken again from the current version of its function
+    auto derive = [&](const CompiledExpression& expression) {
+        
+        if (expression.derivative.empty()) {
+            return CompiledExpression::parse(expression.source, m_parser);
+        }
+        
+        std::string name(expression.dependencies.front()->header->name);
+        auto symbol = symbols.find(name);
+        
+        if (!symbol) {
+            throw std::runtime_error("Unknown function: " + name);
+        }
+        return CompiledExpression::derive(symbol->function, expression.derivative);
+    };
+    
+    // Recompiling a function replaces its symbol, which makes its own callers stale in turn.
+    // Definitions are acyclic, so this ends once the changes have reached every caller
+    std::unordered_set<const Function*> failed;
+    bool updated = true;
+    
+    while (updated) {
+        
+        updated = false;
+        
+        for (auto& function : m_functions) {
+            
+            if (failed.contains(function.get()) || !stale(*function->getCompiled())) {
+                continue;
+            }
+            
+            try {
+                
+                auto compiled = derive(*function->getCompiled());
+                
+                symbols.defineFunction(std::string(compiled->header->name), compiled);
+                function->setCompiled(std::move(compiled));
+                
+                updated = true;
+                
+            } catch (const std::exception& e) {
+                
+                // E.g. the callee has fewer parameters now, the old version stays in use
+                std::print(stderr, "Error recompiling function '{}': {}\n", function->getName(), e.what());
+                failed.insert(function.get());
+            }
+        }
+    }
+}
+
 void Scene::setCallback(EventHandler& eventHandler) {
     eventHandler.subscribe(EventHandler::Listener::MouseScrolled, std::bind(&Scene::setGraphDirty, this));
 }
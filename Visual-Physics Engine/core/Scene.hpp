@@ -9,11 +9,13 @@
 #define SCENE_HPP
 
 #include <SFML/Graphics.hpp>
+#include <span>
 #include <vector>
 
 #include "../Config.hpp"
 #include "../ui/CoordinateSystem.hpp"
 #include "../math/Function.hpp"
+#include "../parser/Parser.hpp"
 #include "ThreadManager.hpp"
 
 
@@ -54,6 +56,19 @@ public:
     
     sf::Vector2f getViewSize() const;
     
+    // Compiles all expressions in parallel, the names are taken from the function headers.
+    // Expressions that fail to parse are reported and skipped
+    void addFunctions(std::span<const std::string> expressions, sf::Color color = config::function::color);
+    
+    // Compiles the expression with the functions of the scene in scope, so it may call them.
+    // A function of the same name is replaced and everything calling it is recompiled.
+    // Parse errors are thrown
+    std::shared_ptr<Function> defineFunction(const std::string& expression, sf::Color color = config::function::color);
+    
+    // Plots the derivative of a scene function with respect to one of its variables next to it.
+    // Redefining the function derives it again, functions without a tree throw
+    std::shared_ptr<Function> addDerivative(const std::string& name, const std::string& variable = "x", sf::Color color = config::function::derivativeColor);
+    
     size_t getFunctionCount() const;
     std::shared_ptr<Function> getFunction(const std::string& name);
     std::shared_ptr<Function> getFunction(size_t index);
@@ -65,6 +80,13 @@ public:
     
     bool playTime();
 
+private:
+    std::shared_ptr<Function> addFunction(std::shared_ptr<const CompiledExpression> compiled, sf::Color color);
+    
+    // Recompiles every function that was compiled against an older version of a function it calls,
+    // derivatives are derived again from the new version
+    void recompileDependents();
+
 private:
     std::vector<std::unique_ptr<sf::Drawable>> m_shapes;
 
@@ -72,6 +94,9 @@ private:
 
     std::vector<std::shared_ptr<Function>> m_functions;
     
+    // Every function of the scene is a user function in its symbol table
+    Parser m_parser;
+    
     sf::Clock& m_clock;
     
     Application& m_application;
@@ -7,6 +7,7 @@
 #include "ThreadManager.hpp"
 
 
+#include <algorithm>
 #include <print>
 
 
@@ -41,6 +42,17 @@ ThreadManager::~ThreadManager() {
 }
 
 
+size_t ThreadManager::chunkCount(size_t items, double itemCost) const {
+    
+    if (items == 0) {
+        return 0;
+    }
+    
+    size_t byCost = static_cast<size_t>(static_cast<double>(items) * itemCost / m_minTaskDuration);
+    
+    return std::clamp<size_t>(byCost, 1, std::min(items, m_threadCount * m_tasksPerThread));
+}
+
 void ThreadManager::initialize() {
     
     m_running = true;
@@ -26,6 +26,10 @@ public:
     
     size_t getThreadCount() const { return m_threadCount; }
     
+    // Number of tasks to split items of the given cost in seconds into. Every thread gets a few,
+    // so uneven items balance out, but no task is so short that queueing it costs more than it saves
+    size_t chunkCount(size_t items, double itemCost) const;
+    
     template<class F, class ...Args>
     auto enqueue(F&& f, Args&&... args) -> std::future<typename std::invoke_result<F, Args...>::type> {
         
@@ -57,6 +61,9 @@ private:
     void workerLoop();
     
 private:
+    static constexpr size_t m_tasksPerThread = 4;
+    static constexpr double m_minTaskDuration = 100e-6;
+    
     size_t m_threadCount;
     
     std::queue<std::function<void()>> m_taskQueue;
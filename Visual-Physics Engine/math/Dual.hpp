@@ -0,0 +1,20 @@
+//
+//  Dual.hpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#ifndef DUAL_HPP
+#define DUAL_HPP
+
+
+/// @struct Dual
+/// @brief Value of a function together with its derivative at the same point,
+/// both computed in a single forward pass.
+struct Dual {
+    double value = 0.0;
+    double derivative = 0.0;
+};
+
+#endif // DUAL_HPP
@@ -8,8 +8,8 @@
 #include "Function.hpp"
 
 #include <iostream>
+#include <chrono>
 #include <future>
-#include <print>
 
 #include <SFML/Graphics/VertexArray.hpp>
 
@@ -25,15 +25,9 @@ Function::Function(const std::string& name, const std::string& expression, Scene
     m_scene(scene),
     m_threadManager(threadManager) {
         
-    m_parser.setExpression(expression);
-
     try {
-        std::unique_ptr<ASTNode> node = m_parser.parse();
-
-        if (auto* raw = dynamic_cast<FunctionHeaderNode*>(node.get())) {
-            std::unique_ptr<FunctionHeaderNode> funcHeader(static_cast<FunctionHeaderNode*>(node.release()));
-            m_function = std::move(funcHeader);
-        }
+        m_compiled = ExpressionCache::instance().get(expression);
+        m_function = m_compiled->header;
 
     } catch (const std::exception& e) {
         std::cerr << "Error parsing function: " << e.what() << std::endl;
@@ -41,6 +35,45 @@ Function::Function(const std::string& name, const std::string& expression, Scene
     }
 }
 
+Function::Function(const std::string& name, std::shared_ptr<const CompiledExpression> compiled, Scene& scene, ThreadManager& threadManager, sf::Color color) :
+    m_name(name),
+    m_expression(compiled->source),
+    m_compiled(std::move(compiled)),
+    m_function(m_compiled->header),
+    m_scene(scene),
+    m_color(color),
+    m_threadManager(threadManager) {
+}
+
+Function::Function(const std::string& name, const sx::Definition& definition, Scene& scene, ThreadManager& threadManager, sf::Color color) :
+    m_name(name),
+    m_scene(scene),
+    m_color(color),
+    m_threadManager(threadManager) {
+    
+    std::string parameters;
+    for (const auto& parameter : definition.parameters) {
+        parameters += (parameters.empty() ? "" : ", ") + parameter;
+    }
+    m_expression = name + "(" + parameters + ") = " + definition.body;
+    
+    // Only the slot table is built here, the tree is parsed from the source when the function is
+    // differentiated or inlined into a caller
+    auto arena = std::make_unique<Arena>();
+    auto* header = arena->make<FunctionHeaderNode>(arena->intern(name), arena->internAll(definition.parameters));
+    
+    auto compiled = std::make_shared<CompiledExpression>();
+    compiled->source = m_expression;
+    compiled->ast = Expression(std::move(arena), header);
+    compiled->header = header;
+    compiled->program = definition.program;
+    compiled->lazyTree = true;
+    
+    m_compiled = std::move(compiled);
+    m_function = header;
+    m_native = std::make_shared<NativeKernel>(nullptr, definition.evaluate, definition.evaluateBatch, definition.evaluateDual);
+}
+
 
 void Function::draw(sf::RenderTarget& target, sf::RenderStates states) const {
     for (const auto& line : m_lines) {
@@ -49,6 +82,10 @@ void Function::draw(sf::RenderTarget& target, sf::RenderStates states) const {
 }
 
 void Function::update() {
+    if (m_flags & NativeCompiled) {
+        updateNative();
+    }
+    
     if (m_graphDirty) {
         m_graphDirty = false;
         
@@ -64,13 +101,70 @@ void Function::update() {
 }
 
 
-void Function::addSegment(std::vector<sf::VertexArray>& lines, sf::VertexArray& current) {
-    if (current.getVertexCount() >= 1) {
+void Function::updateNative() {
+    
+    if (!m_nativeRequested && !m_native) {
+        
+        m_nativeRequested = true;
+        m_nativeBuild = NativeCompiler::compileAsync(m_compiled->program);
+        
+    } else if (m_nativeBuild.valid() && m_nativeBuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
         
-        lines.push_back(current);
+        // Only swapped between sweeps, no plotting task is running at this point
+        m_native = m_nativeBuild.get();
+        
+        if (!m_native) {
+            std::cerr << "Native compilation of function '" << m_name << "' not available, staying interpreted" << std::endl;
+        }
+    }
+}
+
+double Function::evaluate(const Context& context) const {
+    return m_native ? m_native->evaluate(context) : m_sweep.evaluate(context);
+}
+
+void Function::evaluateBatch(std::span<const double> xs, std::span<double> ys, const Context& context, std::size_t slot) const {
+    if (m_native) {
+        m_native->evaluateBatch(xs, ys, context, slot);
+    } else {
+        m_sweep.evaluateBatch(xs, ys, context, slot, m_accuracy);
+    }
+}
+
+
+std::optional<std::pair<sf::Vector2f, sf::Vector2f>> Function::findBoundary(std::size_t slot, sf::Vector2f p0, sf::Vector2f p1, Context context) const {
+    
+    double& x = context[slot];
+    
+    x = p0.x;
+    std::uint64_t left = m_sweep.branches(context);
+    
+    x = p1.x;
+    if (m_sweep.branches(context) == left) {
+        return std::nullopt;
     }
     
-    current = sf::VertexArray(sf::PrimitiveType::LineStrip);
+    double a = p0.x;
+    double b = p1.x;
+    
+    for (int i = 0; i < config::function::boundarySteps; ++i) {
+        
+        x = (a + b) / 2;
+        
+        if (m_sweep.branches(context) == left) {
+            a = x;
+        } else {
+            b = x;
+        }
+    }
+    
+    x = a;
+    sf::Vector2f before(a, evaluate(context));
+    
+    x = b;
+    sf::Vector2f after(b, evaluate(context));
+    
+    return std::pair{before, after};
 }
 
 bool Function::hasVariable(const std::string& variable) const {
@@ -90,10 +184,31 @@ Environment& Function::getEnvironment() {
 }
 
 void Function::initializeEnvironment() {
-    for (const auto& parameter : m_function->getParameters()) {
-        m_environment[parameter] = 0.0;
+    // Free variables, e.g. the t passed on to a called function, need a value as well
+    for (std::string_view variable : m_function->getVariables()) {
+        m_environment.try_emplace(std::string(variable), 0.0);
     }
 }
+
+void Function::setCompiled(std::shared_ptr<const CompiledExpression> compiled) {
+    
+    m_compiled = std::move(compiled);
+    m_function = m_compiled->header;
+    m_expression = m_compiled->source;
+    
+    // Native code of the old program is dropped and requested again on the next update.
+    // A build that is still running is abandoned without waiting for it
+    m_native.reset();
+    m_nativeBuild = {};
+    m_nativeRequested = false;
+    
+    m_curvature.reset();
+    m_curvatureVariable.reset();
+    m_segmentCost = 0.0;
+    
+    initializeEnvironment();
+    graphDirty();
+}
     
 
 void Function::setVariable(const std::string& variable, double value) {
@@ -146,17 +261,43 @@ std::vector<std::string> Function::getParameters() const {
     return parameters;
 }
 
+const Program* Function::curvature(const std::string& variable) {
+    
+    if (m_curvatureVariable != variable) {
+        
+        m_curvatureVariable = variable;
+        m_curvature.reset();
+        
+        try {
+            
+            auto curvature = CompiledExpression::derive(CompiledExpression::derive(m_compiled, variable), variable);
+            
+            if (curvature->program.size() <= m_compiled->program.size() * config::function::maxCurvatureGrowth) {
+                m_curvature = std::move(curvature);
+            }
+            
+        } catch (const std::exception& e) {
+            std::cerr << "Second derivative of function '" << m_name << "' not available: " << e.what() << std::endl;
+        }
+    }
+    
+    return m_curvature ? &m_curvature->program : nullptr;
+}
+
 void Function::calculateInterval() {
     
-    calculateInterval(m_environment);
+    calculateInterval(m_function->bind(m_environment));
 }
 
-void Function::calculateInterval(Environment env) {
+void Function::calculateInterval(Context context) {
+    
+    std::size_t xSlot = m_function->getSlot("x");
     
-    float& x = env.at("x");
+    m_sweep = m_compiled->program.specialize(context, xSlot);
+    m_piecewise = m_sweep.hasBranches();
     
-    m_currentLine.clear();
-    m_lines.clear();
+    const Program* bend = curvature("x");
+    m_sweepCurvature = bend ? bend->specialize(context, xSlot) : Program();
 
     sf::Vector2f worldOrigin = m_scene.getTranslation();
     sf::Vector2f viewSize = m_scene.getViewSize();
@@ -164,93 +305,35 @@ void Function::calculateInterval(Environment env) {
     double xMin = (worldOrigin.x - viewSize.x);
     double xMax = (worldOrigin.x + viewSize.x);
     
-    /*
-    double gridLength = viewSize.x / config::function::coarseSteps;
-    int nSteps = static_cast<int>((xMax - xMin) / gridLength);
-     */
-    int nSteps = static_cast<int>(m_threadManager.getThreadCount()) * 20;
+    // Coarse grid in screen space, the same samples per pixel column on every machine
+    int nSteps = std::max(1, static_cast<int>(std::ceil((xMax - xMin) / pixelSize().x * config::function::coarseSamplesPerPixel)));
     double gridLength = (xMax - xMin) / nSteps;
-    std::print("Function::calculateInterval: nSteps = {}, gridLength = {}\n", nSteps, m_scene.worldToScreen({static_cast<float>(gridLength), 0}).x);
-    
-    bool lastValid = false;
-    
-    double lastWorldX = xMin;
-    double lastWorldY = m_function->evaluate(env);
-    
-    std::vector<std::future<std::vector<sf::VertexArray>>> futures;
-
-    for (int i = 1; i <= nSteps; ++i) {
-        
-        x = xMin + i * gridLength;
-        double y = m_function->evaluate(env);
-        
-        bool valid = !std::isnan(y) && !std::isinf(y);
-
-        if (!lastValid && valid) {
-            
-            m_currentLine.append(sf::Vertex(m_scene.worldToScreen(sf::Vector2f(x, y)), m_color));
-            
-        } else if (lastValid && valid) {
-            
-            double xCopy = x;
-            double yCopy = y;
-            double lastWorldXCopy = lastWorldX;
-            double lastWorldYCopy = lastWorldY;
-            
-            Environment envCopy = env;
-            
-            futures.push_back(m_threadManager.enqueue([=, this]() mutable {
-                
-                std::vector<sf::VertexArray> result = adaptivePlot("t", sf::Vector2f(lastWorldXCopy, lastWorldYCopy), sf::Vector2f(xCopy, yCopy), {0.f, 0.f}, 0, config::function::maxDepth, envCopy);
-                
-                return result;
-            }));
-            /*
-            adaptivePlot("x", sf::Vector2f(lastWorldX, lastWorldY), sf::Vector2f(x, y), {0.f, 0.f}, 0, config::function::maxDepth, env);
-            */
-        } else if (lastValid && !valid) {
-            
-            addSegment(m_lines, m_currentLine);
-        }
-        
-        lastValid = valid;
-        
-        lastWorldX = x;
-        lastWorldY = y;
-    }
-    addSegment(m_lines, m_currentLine);
     
-    for (auto& fut : futures) {
-        auto result = fut.get();
-        for (auto& arr : result) {
-            addSegment(m_lines, arr);
-        }
-    }
+    m_samples.resize(nSteps + 1);
+    m_values.resize(nSteps + 1);
     
-    sf::VertexArray merged(sf::PrimitiveType::LineStrip);
-    for (auto& line : m_lines) {
-        for (size_t i = 0; i < line.getVertexCount(); ++i) {
-            merged.append(line[i]);
-        }
+    for (int i = 0; i <= nSteps; ++i) {
+        m_samples[i] = xMin + i * gridLength;
     }
-    m_lines.clear();
-    m_lines.push_back(merged);
-    
-    std::print("-->Finished calculating {} intervals for function '{}'\n", m_lines.size(), m_name);
-    std::print("-->{} empty segments\n", m_emptyCount.load());
-    std::print("-->Size of merged line: {}\n", m_lines[0].getVertexCount());
-    m_emptyCount = 0; // Reset empty count after plotting
     
+    refine(xSlot, {0.f, 0.f}, context);
 }
 
 
 void Function::calculateWave() {
-    calculateWave(m_environment);
+    calculateWave(m_function->bind(m_environment));
 }
 
-void Function::calculateWave(Environment env) {
+void Function::calculateWave(Context context) {
+    
+    std::size_t tSlot = m_function->getSlot("t");
+    double t = context[tSlot];
     
-    float& t = env.at("t");
+    m_sweep = m_compiled->program.specialize(context, tSlot);
+    m_piecewise = m_sweep.hasBranches();
+    
+    const Program* bend = curvature("t");
+    m_sweepCurvature = bend ? bend->specialize(context, tSlot) : Program();
     
     sf::Vector2f viewSize = m_scene.getViewSize();
     sf::Vector2f worldOrigin = m_scene.getTranslation();
@@ -260,239 +343,300 @@ void Function::calculateWave(Environment env) {
     double tauMin = std::max(0.0, static_cast<double>(t + worldOrigin.x - viewSize.x));
     double tauMax = t;
     
-    double tau;
-
-    /*
-    double gridLength = viewSize.x / config::function::coarseSteps;
-    int nSteps = static_cast<int>((xMax - xMin) / gridLength);
-     */
-    int nSteps = static_cast<int>(m_threadManager.getThreadCount()) * 20;
+    // Same screen space grid as for functions of x, only the visible part of the past is sampled
+    int nSteps = std::max(1, static_cast<int>(std::ceil((tauMax - tauMin) / pixelSize().x * config::function::coarseSamplesPerPixel)));
     double gridLength = (tauMax - tauMin) / nSteps;
-    std::print("Function::calculateWave: nSteps = {}, gridLength = {}\n", nSteps, m_scene.worldToScreen({static_cast<float>(gridLength), 0}).x);
-
-    bool lastValid = false;
-    double lastT = t, lastY = m_function->evaluate(env);
-
-    m_currentLine.clear();
-    m_lines.clear();
     
-    std::vector<std::future<std::vector<sf::VertexArray>>> futures;
+    m_samples.resize(nSteps + 1);
+    m_values.resize(nSteps + 1);
+    
+    for (int i = 0; i <= nSteps; ++i) {
+        m_samples[i] = tauMin + i * gridLength;
+    }
+    
+    refine(tSlot, {- static_cast<float>(tauMax), 0.f}, context);
+}
 
-    for (int i = 0; i < nSteps; ++i) {
-        tau = tauMin + i * gridLength;
-        
-        if (tau > tauMax) {
-            break;
+void Function::refine(std::size_t slot, sf::Vector2f offset, const Context& context) {
+    
+    // The coarse grid is evaluated in one batch, its cost per sample estimates the first refinement
+    auto start = std::chrono::steady_clock::now();
+    evaluateBatch(m_samples, m_values, context, slot);
+    
+    std::chrono::duration<double> batch = std::chrono::steady_clock::now() - start;
+    m_sampleCost = batch.count() / static_cast<double>(m_samples.size());
+    
+    // Pieces between two valid coarse samples, each is refined on its own
+    m_segments.clear();
+    
+    for (std::size_t i = 1; i < m_samples.size(); ++i) {
+        if (std::isfinite(m_values[i - 1]) && std::isfinite(m_values[i])) {
+            m_segments.push_back(i);
         }
-
-        t = tau;
-
-        double y = m_function->evaluate(env);
-
-        bool valid = !std::isnan(y) && !std::isinf(y);
-
-        if (!lastValid && valid) {
-            m_currentLine.append(sf::Vertex(m_scene.worldToScreen(sf::Vector2f(t - tauMax, y)), m_color));
-        } else if (lastValid && valid) {
+    }
+    
+    // Chunks only group consecutive pieces, the plot is the same however many there are
+    std::size_t chunks = m_threadManager.chunkCount(m_segments.size(), m_segmentCost > 0 ? m_segmentCost : m_sampleCost);
+    
+    // Every task writes only to its own buffer, the buffers are never resized while tasks run
+    if (m_chunks.size() < chunks) {
+        m_chunks.resize(chunks);
+    }
+    
+    std::vector<std::future<double>> futures;
+    futures.reserve(chunks);
+    
+    for (std::size_t chunk = 0; chunk < chunks; ++chunk) {
+        
+        std::size_t begin = m_segments.size() * chunk / chunks;
+        std::size_t end = m_segments.size() * (chunk + 1) / chunks;
+        
+        // Every future is waited for below, the context outlives the tasks
+        futures.push_back(m_threadManager.enqueue([=, this, &context]() {
             
-            double tauMaxCopy = tauMax;
-            Environment envCopy = env;
+            auto start = std::chrono::steady_clock::now();
             
-            futures.push_back(
-                              m_threadManager.enqueue([=, this]() mutable {
-                    std::vector<sf::VertexArray> result = adaptivePlot("t", sf::Vector2f(lastT, lastY), sf::Vector2f(t, y), {- static_cast<float>(tauMaxCopy),0.f}, 0, config::function::maxDepth, envCopy);
-                    
-                    return result;
-                }));
-            /*
-            adaptivePlot("t", sf::Vector2f(lastT, lastY), sf::Vector2f(t, y), {- static_cast<float>(tauMax),0.f}, 0, config::function::maxDepth, env);
-            */
+            PlotBuffer& buffer = m_chunks[chunk];
+            buffer.vertices.clear();
+            buffer.breaks.clear();
             
+            for (std::size_t s = begin; s < end; ++s) {
+                
+                std::size_t i = m_segments[s];
+                
+                sf::Vector2f p0(m_samples[i - 1], m_values[i - 1]);
+                sf::Vector2f p1(m_samples[i], m_values[i]);
+                
+                // First piece after an invalid sample, the line starts at its left end
+                bool startsLine = i == 1 || !std::isfinite(m_values[i - 2]);
+                
+                adaptivePlot(slot, p0, p1, offset, startsLine, context, buffer);
+            }
             
-        } else if (lastValid && !valid) {
-            addSegment(m_lines, m_currentLine);
-        }
-
-        lastValid = valid;
-        lastT = t;
-        lastY = y;
+            std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+            return duration.count();
+        }));
     }
     
-    for (auto& fut : futures) {
-        auto result = fut.get();
-        for (auto& arr : result) {
-            addSegment(m_lines, arr);
-        }
+    double seconds = 0.0;
+    
+    for (auto& future : futures) {
+        seconds += future.get();
     }
     
-    sf::VertexArray merged(sf::PrimitiveType::LineStrip);
-    for (auto& line : m_lines) {
-        for (size_t i = 0; i < line.getVertexCount(); ++i) {
-            merged.append(line[i]);
+    // Lines of the last sweep are cleared and refilled, only a break starts a new one
+    std::size_t lineCount = 1;
+    
+    if (m_lines.empty()) {
+        m_lines.emplace_back(sf::PrimitiveType::LineStrip);
+    }
+    m_lines[0].clear();
+    
+    // A break behind the last vertex of a chunk starts the line of the next one
+    bool lineBreak = false;
+    
+    for (std::size_t chunk = 0; chunk < chunks; ++chunk) {
+        
+        const PlotBuffer& buffer = m_chunks[chunk];
+        std::size_t next = 0;
+        
+        for (std::size_t v = 0; v < buffer.vertices.size(); ++v) {
+            
+            if (next < buffer.breaks.size() && buffer.breaks[next] == v) {
+                
+                ++next;
+                lineBreak = true;
+            }
+            
+            if (lineBreak && m_lines[lineCount - 1].getVertexCount() > 0) {
+                
+                if (lineCount == m_lines.size()) {
+                    m_lines.emplace_back(sf::PrimitiveType::LineStrip);
+                }
+                m_lines[lineCount++].clear();
+            }
+            lineBreak = false;
+            
+            m_lines[lineCount - 1].append(buffer.vertices[v]);
         }
+        
+        lineBreak = lineBreak || next < buffer.breaks.size();
     }
-    m_lines.clear();
-    m_lines.push_back(merged);
     
-    std::print("-->Finished calculating {} intervals for function '{}'\n", m_lines.size(), m_name);
-    std::print("-->{} empty segments\n", m_emptyCount.load());
-    std::print("-->Size of merged line: {}\n", m_lines[0].getVertexCount());
-    m_emptyCount = 0; // Reset empty count after plotting
+    m_lines.resize(lineCount);
+    
+    m_segmentCost = m_segments.empty() ? 0.0 : seconds / static_cast<double>(m_segments.size());
 }
 
+sf::Vector2f Function::pixelSize() const {
+    
+    sf::Vector2f unit = m_scene.worldToScreen({1.f, 1.f}) - m_scene.worldToScreen({0.f, 0.f});
+    
+    return {1.f / std::abs(unit.x), 1.f / std::abs(unit.y)};
+}
+
+Function::Sample Function::sample(std::size_t slot, double x, Context context) const {
+    
+    context[slot] = x;
+    Dual dual = m_native ? m_native->evaluateDual(context, slot) : m_sweep.evaluateDual(context, slot);
+    
+    return {sf::Vector2f(x, dual.value), dual.derivative};
+}
 
-std::vector<sf::VertexArray> Function::adaptivePlot(std::string key, sf::Vector2f p0, sf::Vector2f p1, sf::Vector2f offset, int depth, int maxDepth, Environment env) {
+void Function::adaptivePlot(std::size_t slot, sf::Vector2f left, sf::Vector2f right, sf::Vector2f offset, bool startsLine, const Context& context, PlotBuffer& buffer) const {
+    
+    // A piece that still has to be plotted, after a break its line starts again at its left end
+    struct Piece {
+        Sample s0;
+        Sample s1;
+        int depth;
+        bool startsLine;
+    };
+    
+    // Shared by every piece refined on this thread, it only allocates while it grows
+    thread_local std::vector<Piece> stack;
+    stack.clear();
+    
+    auto append = [&](sf::Vector2f p) {
+        buffer.vertices.push_back(sf::Vertex(m_scene.worldToScreen({p.x + offset.x, p.y + offset.y}), m_color));
+    };
+    
+    auto breakLine = [&]() {
+        if (buffer.breaks.empty() || buffer.breaks.back() != buffer.vertices.size()) {
+            buffer.breaks.push_back(buffer.vertices.size());
+        }
+    };
     
-    // Local variables for thread safety
-    std::vector<sf::VertexArray> lines;
-    sf::VertexArray currentLine(sf::PrimitiveType::LineStrip);
+    sf::Vector2f pixel = pixelSize();
+    double pixelX = pixel.x;
+    double tolerance = config::function::tolerance * pixel.y;
     
+    sf::Vector2f worldOrigin = m_scene.getTranslation();
     sf::Vector2f viewSize = m_scene.getViewSize();
     
-    double deltaYMax = static_cast<double>(viewSize.y) * config::function::deltaMaxPercent;
-    double deltaXMin = static_cast<double>(viewSize.x) * config::function::deltaMinMultiplier;
+    // The coarse values are kept, only the slopes are added
+    stack.push_back({{left, sample(slot, left.x, context).slope}, {right, sample(slot, right.x, context).slope}, 0, startsLine});
     
-    if (depth >= maxDepth) {
-        
-        currentLine.append(sf::Vertex(m_scene.worldToScreen({(p1.x + offset.x), p1.y + offset.y}), m_color));
+    while (!stack.empty()) {
         
-        if (currentLine.getVertexCount() >= 1) {
-            lines.push_back(currentLine);
-        } else {
-            m_emptyCount++;
-        }
+        Piece piece = stack.back();
+        stack.pop_back();
         
-        return lines;
-    }
-
-    if (std::abs(p1.y - p0.y) > deltaYMax || std::abs(p1.x - p0.x) > deltaXMin) {
+        const Sample& s0 = piece.s0;
+        const Sample& s1 = piece.s1;
         
-        // Polstelle
-        if (std::abs(p0.y) > config::function::cutoff &&
-            std::abs(p1.y) > config::function::cutoff &&
-            p0.y * p1.y < 0) {
-
-            addSegment(lines, currentLine);
-            return lines;
-        }
+        sf::Vector2f p0 = s0.point;
+        sf::Vector2f p1 = s1.point;
         
-        // Polstelle
-        if (std::abs(p1.y - p0.y) > deltaYMax &&
-           (std::abs(p0.y) > config::function::cutoff || std::abs(p1.y) > config::function::cutoff)) {
+        if (piece.startsLine) {
             
-            addSegment(lines, currentLine);
-            return lines;
+            breakLine();
+            append(p0);
         }
         
-        // Polstelle
-        if (std::abs(p1.y - p0.y) > deltaYMax * 200 &&
-            std::abs((p1.y - p0.y) / (p1.x - p0.x)) > deltaYMax * 100) {
+        if (piece.depth >= config::function::maxDepth) {
             
-            addSegment(lines, currentLine);
-            return lines;
+            append(p1);
+            continue;
         }
         
-        float& xm = env.at(key);
-        
-        xm = (p0.x + p1.x) / 2.f;
-        double ym = m_function->evaluate(env);
+        // Guaranteed bounds of the function between p0 and p1
+        Interval range{std::min<double>(p0.x, p1.x), std::max<double>(p0.x, p1.x)};
+        Interval y = m_sweep.evaluateInterval(context, slot, range);
         
-        if (std::isnan(ym) || std::isinf(ym)) {
+        // Entirely above or below the view, the chord is as good as the curve
+        if (y.hi + offset.y < worldOrigin.y - viewSize.y || y.lo + offset.y > worldOrigin.y + viewSize.y) {
             
-            addSegment(lines, currentLine);
-            return lines;
+            append(p1);
+            continue;
         }
         
-        sf::Vector2f mid(xm, ym);
-        std::vector<sf::VertexArray> localResult;
-        
-        adaptivePlot(key, p0, mid, offset, depth + 1, maxDepth, env, lines, currentLine);
-        
-        adaptivePlot(key, mid, p1, offset, depth + 1, maxDepth, env, lines, currentLine);
-
-    } else {
-        
-        currentLine.append(sf::Vertex(m_scene.worldToScreen({(p1.x + offset.x), p1.y + offset.y}), m_color));
-    }
-    
-    if (currentLine.getVertexCount() >= 1) {
-        lines.push_back(currentLine);
-    } else {
-        m_emptyCount++;
-    }
-    return lines;
-}
-
-void Function::adaptivePlot(std::string key, sf::Vector2f p0, sf::Vector2f p1, sf::Vector2f offset, int depth, int maxDepth, Environment env, std::vector<sf::VertexArray> &lines, sf::VertexArray &currentLine) {
-    
-    sf::Vector2f viewSize = m_scene.getViewSize();
-    
-    double deltaYMax = static_cast<double>(viewSize.y) * config::function::deltaMaxPercent;
-    double deltaXMin = static_cast<double>(viewSize.x) * config::function::deltaMinMultiplier;
-    
-    if (depth >= maxDepth) {
+        // Flat, no point of the curve is further than the tolerance from the chord
+        if (y.continuous && y.width() <= tolerance) {
+            
+            append(p1);
+            continue;
+        }
         
-        currentLine.append(sf::Vertex(m_scene.worldToScreen({(p1.x + offset.x), p1.y + offset.y}), m_color));
+        bool jump = !y.continuous && std::abs(p1.y - p0.y) > tolerance;
         
-        if (currentLine.getVertexCount() >= 1) {
-            lines.push_back(currentLine);
-        } else {
-            m_emptyCount++;
+        // Jump at a piecewise boundary, both pieces are plotted up to the boundary instead of refining the jump.
+        // The right piece goes on the stack first, so the left one is plotted before it
+        if (m_piecewise && jump) {
+            
+            if (auto boundary = findBoundary(slot, p0, p1, context)) {
+                
+                auto [before, after] = *boundary;
+                
+                stack.push_back({sample(slot, after.x, context), s1, piece.depth + 1, true});
+                stack.push_back({s0, sample(slot, before.x, context), piece.depth + 1, false});
+                continue;
+            }
         }
-    }
-
-    if (std::abs(p1.y - p0.y) > deltaYMax || std::abs(p1.x - p0.x) > deltaXMin) {
-        /*
-        // Polstelle
-        if (std::abs(p0.y) > config::function::cutoff &&
-            std::abs(p1.y) > config::function::cutoff &&
-            p0.y * p1.y < 0) {
-
-            addSegment(lines, currentLine);
+        
+        // Within one pixel column refining can not improve the picture anymore,
+        // a pole or jump inside it ends the line
+        if (range.width() <= pixelX) {
+            
+            if (jump) {
+                breakLine();
+            }
+            append(p1);
+            continue;
         }
         
-        // Polstelle
-        if (std::abs(p1.y - p0.y) > deltaYMax &&
-           (std::abs(p0.y) > config::function::cutoff || std::abs(p1.y) > config::function::cutoff)) {
+        // The chord of a piece of width h is at most max|f''| h^2 / 8 away from the curve,
+        // so steep but straight pieces are kept however large their height is
+        if (!m_sweepCurvature.empty() && y.continuous) {
             
-            addSegment(lines, currentLine);
+            Interval bend = m_sweepCurvature.evaluateInterval(context, slot, range);
+            double h = range.width();
+            
+            if (bend.continuous && bend.bounded() && std::max(std::abs(bend.lo), std::abs(bend.hi)) * h * h / 8 <= tolerance) {
+                
+                append(p1);
+                continue;
+            }
         }
         
-        // Polstelle
-        if (std::abs(p1.y - p0.y) > deltaYMax * 200 &&
-            std::abs((p1.y - p0.y) / (p1.x - p0.x)) > deltaYMax * 100) {
+        // Split where the tangents of both ends cross, that is where the curve bends. The split stays
+        // in the middle half so both pieces shrink, parallel tangents split in the middle
+        double xm = (p0.x + p1.x) / 2.0;
+        
+        if (s0.slope != s1.slope) {
             
-            addSegment(lines, currentLine);
+            double crossing = (p1.y - p0.y + s0.slope * p0.x - s1.slope * p1.x) / (s0.slope - s1.slope);
+            
+            if (std::isfinite(crossing)) {
+                xm = std::clamp(crossing, range.lo + range.width() / 4, range.hi - range.width() / 4);
+            }
         }
-        */
-        float& xm = env.at(key);
         
-        xm = (p0.x + p1.x) / 2.f;
-        double ym = m_function->evaluate(env);
+        Sample mid = sample(slot, xm, context);
+        double ym = mid.point.y;
         
         if (std::isnan(ym) || std::isinf(ym)) {
             
-            addSegment(lines, currentLine);
+            breakLine();
+            continue;
         }
         
-        sf::Vector2f mid(xm, ym);
-        std::vector<sf::VertexArray> localResult;
+        // Without a second derivative the curve has to stay inside the band of the chord and pass it at the split
+        double chord = p0.y + (p1.y - p0.y) * (xm - p0.x) / (p1.x - p0.x);
         
-        localResult = adaptivePlot(key, p0, mid, offset, depth + 1, maxDepth, env);
-        lines.insert(lines.end(), localResult.begin(), localResult.end());
+        bool straight = m_sweepCurvature.empty() &&
+                        y.continuous &&
+                        y.lo >= std::min(p0.y, p1.y) - tolerance &&
+                        y.hi <= std::max(p0.y, p1.y) + tolerance &&
+                        std::abs(ym - chord) <= tolerance;
         
-        localResult = adaptivePlot(key, mid, p1, offset, depth + 1, maxDepth, env);
-        lines.insert(lines.end(), localResult.begin(), localResult.end());
-
-    } else {
+        if (straight) {
+            
+            append(p1);
+            continue;
+        }
         
-        currentLine.append(sf::Vertex(m_scene.worldToScreen({(p1.x + offset.x), p1.y + offset.y}), m_color));
-    }
-    
-    if (currentLine.getVertexCount() >= 1) {
-        lines.push_back(currentLine);
-    } else {
-        m_emptyCount++;
+        stack.push_back({mid, s1, piece.depth + 1, false});
+        stack.push_back({s0, mid, piece.depth + 1, false});
     }
 }
-
@@ -8,13 +8,17 @@
 #ifndef FUNCTION_HPP
 #define FUNCTION_HPP
 
-#include <atomic>
+#include <optional>
+#include <utility>
 
 
 #include <SFML/Graphics.hpp>
 
 
-#include "../parser/Parser.hpp"
+#include "../parser/ExpressionCache.hpp"
+#include "../parser/Program.hpp"
+#include "../parser/NativeCompiler.hpp"
+#include "StaticExpression.hpp"
 
 
 class Scene;
@@ -30,10 +34,17 @@ public:
         NoParameters = 1 << 2,
         Animated = 1 << 3,
         XPlot = 1 << 4,
-        Waveform = 1 << 5
+        Waveform = 1 << 5,
+        NativeCompiled = 1 << 6 // Opt-in, builds machine code in the background and switches to it when ready
     };
 public:
     Function(const std::string& name, const std::string& expression, Scene& scene, ThreadManager& threadManager, sf::Color color = sf::Color::Green);
+    
+    // Shares an expression that was already compiled, e.g. by ExpressionCache::getAll
+    Function(const std::string& name, std::shared_ptr<const CompiledExpression> compiled, Scene& scene, ThreadManager& threadManager, sf::Color color = sf::Color::Green);
+    
+    // Built from an expression template, evaluated by its inlined kernel without parsing
+    Function(const std::string& name, const sx::Definition& definition, Scene& scene, ThreadManager& threadManager, sf::Color color = sf::Color::Green);
 
     void draw(sf::RenderTarget& target, sf::RenderStates states) const override;
     
@@ -58,19 +69,63 @@ public:
     std::string getName() const { return m_name; }
     
     std::vector<std::string> getParameters() const;
+    
+    const std::shared_ptr<const CompiledExpression>& getCompiled() const { return m_compiled; }
+    
+    // Switches to another version of the expression, e.g. after a function it calls was redefined
+    void setCompiled(std::shared_ptr<const CompiledExpression> compiled);
+    
+    // Accuracy tier of the transcendental builtins in batch evaluation
+    void setAccuracy(simd::Accuracy accuracy) { m_accuracy = accuracy; }
+    simd::Accuracy getAccuracy() const { return m_accuracy; }
         
     void graphDirty(bool dirty = true) { m_graphDirty = dirty; }
 
 private:
+    void updateNative();
+    
+    double evaluate(const Context& context) const;
+    void evaluateBatch(std::span<const double> xs, std::span<double> ys, const Context& context, std::size_t slot) const;
+    
     void calculateInterval();
-    void calculateInterval(Environment env);
+    void calculateInterval(Context context);
     
     void calculateWave();
-    void calculateWave(Environment env);
+    void calculateWave(Context context);
+    
+    // Refines the coarse grid of the sweep between every two valid samples into m_lines
+    void refine(std::size_t slot, sf::Vector2f offset, const Context& context);
+    
+    // Size of one pixel in world units
+    sf::Vector2f pixelSize() const;
+    
+    // Second derivative for a sweep over the variable, derived once per compiled expression.
+    // Empty when it can not be derived or would cost too much per sample
+    const Program* curvature(const std::string& variable);
+    
+    // Points just left and right of a piecewise boundary between p0 and p1, located by bisecting
+    // on the branch pattern of the sweep. Empty if both points lie on the same piece
+    std::optional<std::pair<sf::Vector2f, sf::Vector2f>> findBoundary(std::size_t slot, sf::Vector2f p0, sf::Vector2f p1, Context context) const;
+    
+    // Point of the sweep together with the slope of the curve there
+    struct Sample {
+        sf::Vector2f point;
+        double slope;
+    };
     
-    void addSegment(std::vector<sf::VertexArray>& lines, sf::VertexArray& current);
-    std::vector<sf::VertexArray> adaptivePlot(std::string key, sf::Vector2f p0, sf::Vector2f p1, sf::Vector2f offset, int depth, int maxDepth, Environment env);
-    void adaptivePlot(std::string key, sf::Vector2f p0, sf::Vector2f p1, sf::Vector2f offset, int depth, int maxDepth, Environment env, std::vector<sf::VertexArray>& lines, sf::VertexArray& currentLine);
+    // Value and slope in one dual evaluation, on the native kernel once there is one
+    Sample sample(std::size_t slot, double x, Context context) const;
+    
+    // Refined curve in screen space, a new line starts at every index in breaks.
+    // Only cleared between sweeps, so a sweep reuses the memory of the last one
+    struct PlotBuffer {
+        std::vector<sf::Vertex> vertices;
+        std::vector<std::size_t> breaks;
+    };
+    
+    // Refines the piece between two coarse samples into the buffer. Pieces that still have to be
+    // split wait on an explicit stack instead of the call stack, left pieces are plotted first
+    void adaptivePlot(std::size_t slot, sf::Vector2f left, sf::Vector2f right, sf::Vector2f offset, bool startsLine, const Context& context, PlotBuffer& buffer) const;
 
 private:
     std::string m_name;
@@ -78,22 +133,53 @@ private:
     
     Environment m_environment;
 
-    std::unique_ptr<FunctionHeaderNode> m_function;
+    // Shared with every function of the same source through the ExpressionCache,
+    // m_function is the root of its tree
+    std::shared_ptr<const CompiledExpression> m_compiled;
+    const FunctionHeaderNode* m_function = nullptr;
+    
+    // Compiled program specialized for the current sweep, everything but the swept variable is constant
+    Program m_sweep;
+    
+    // Second derivative of the sweep, bounds the distance between a chord and the curve
+    std::shared_ptr<const CompiledExpression> m_curvature;
+    std::optional<std::string> m_curvatureVariable;
+    Program m_sweepCurvature;
+    
+    // The sweep contains comparisons or selects, jumps at their boundaries are not refined
+    bool m_piecewise = false;
+    
+    // Replaces the interpreter once the background build is done, stays empty without a compiler.
+    // Set from the start for functions built from a static expression
+    std::shared_ptr<NativeKernel> m_native;
+    std::future<std::shared_ptr<NativeKernel>> m_nativeBuild;
+    bool m_nativeRequested = false;
     uint32_t m_flags = None;
+    
+    // A plot only needs sub-pixel accuracy
+    simd::Accuracy m_accuracy = simd::Accuracy::Fast;
 
-    Parser m_parser;
     Scene& m_scene;
 
     std::vector<sf::VertexArray> m_lines;
-    sf::VertexArray m_currentLine;
+    
+    // Coarse grid of the last sweep, reused between frames
+    std::vector<double> m_samples;
+    std::vector<double> m_values;
+    
+    // Indices of the coarse pieces that are refined and one output buffer per task, kept between sweeps
+    std::vector<std::size_t> m_segments;
+    std::vector<PlotBuffer> m_chunks;
+    
+    // Measured on the last sweep in seconds, they decide how the refinement is split into tasks
+    double m_sampleCost = 0.0;
+    double m_segmentCost = 0.0;
 
     sf::Color m_color;
     
     bool m_graphDirty = true;
     
     ThreadManager& m_threadManager;
-    
-    std::atomic<int> m_emptyCount{0};
 };
 
 #endif // FUNCTION_HPP
@@ -0,0 +1,37 @@
+//
+//  Interval.hpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#ifndef INTERVAL_HPP
+#define INTERVAL_HPP
+
+#include <cmath>
+#include <limits>
+
+
+/// @struct Interval
+/// @brief Bounds [lo, hi] of a function over a range of its argument.
+/// Every value the function takes on the range lies inside the bounds, they may be wider than necessary.
+/// continuous is cleared as soon as the function may jump or have a pole on the range,
+/// a set flag with unbounded bounds is impossible.
+struct Interval {
+    double lo = 0.0;
+    double hi = 0.0;
+    bool continuous = true;
+
+    static Interval point(double value) { return {value, value}; }
+
+    // Nothing is known, used for poles and undefined values
+    static Interval whole() {
+        return {-std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(), false};
+    }
+
+    double width() const { return hi - lo; }
+    bool contains(double value) const { return lo <= value && value <= hi; }
+    bool bounded() const { return std::isfinite(lo) && std::isfinite(hi); }
+};
+
+#endif // INTERVAL_HPP
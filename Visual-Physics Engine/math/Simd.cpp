@@ -0,0 +1,602 @@
+//
+//  Simd.cpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#include "Simd.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "VectorMath.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define SIMD_X86 1
+    #include <immintrin.h>
+    #define SIMD_AVX2 __attribute__((target("avx2")))
+#elif defined(__aarch64__)
+    #define SIMD_NEON 1
+    #include <arm_neon.h>
+#endif
+
+
+namespace {
+
+    // ***** Lane operations *****
+
+    struct Add {
+        static double scalar(double a, double b) { return a + b; }
+#if SIMD_X86
+        static __m128d sse2(__m128d a, __m128d b) { return _mm_add_pd(a, b); }
+        SIMD_AVX2 static __m256d avx2(__m256d a, __m256d b) { return _mm256_add_pd(a, b); }
+#elif SIMD_NEON
+        static float64x2_t neon(float64x2_t a, float64x2_t b) { return vaddq_f64(a, b); }
+#endif
+    };
+
+    struct Subtract {
+        static double scalar(double a, double b) { return a - b; }
+#if SIMD_X86
+        static __m128d sse2(__m128d a, __m128d b) { return _mm_sub_pd(a, b); }
+        SIMD_AVX2 static __m256d avx2(__m256d a, __m256d b) { return _mm256_sub_pd(a, b); }
+#elif SIMD_NEON
+        static float64x2_t neon(float64x2_t a, float64x2_t b) { return vsubq_f64(a, b); }
+#endif
+    };
+
+    struct Multiply {
+        static double scalar(double a, double b) { return a * b; }
+#if SIMD_X86
+        static __m128d sse2(__m128d a, __m128d b) { return _mm_mul_pd(a, b); }
+        SIMD_AVX2 static __m256d avx2(__m256d a, __m256d b) { return _mm256_mul_pd(a, b); }
+#elif SIMD_NEON
+        static float64x2_t neon(float64x2_t a, float64x2_t b) { return vmulq_f64(a, b); }
+#endif
+    };
+
+    // Division by zero yields 0, the quotient is computed for every lane and masked afterwards
+    struct Divide {
+        static double scalar(double a, double b) { return b == 0 ? 0.0 : a / b; }
+#if SIMD_X86
+        static __m128d sse2(__m128d a, __m128d b) {
+            __m128d zero = _mm_cmpeq_pd(b, _mm_setzero_pd());
+            return _mm_andnot_pd(zero, _mm_div_pd(a, b));
+        }
+        SIMD_AVX2 static __m256d avx2(__m256d a, __m256d b) {
+            __m256d zero = _mm256_cmp_pd(b, _mm256_setzero_pd(), _CMP_EQ_OQ);
+            return _mm256_andnot_pd(zero, _mm256_div_pd(a, b));
+        }
+#elif SIMD_NEON
+        static float64x2_t neon(float64x2_t a, float64x2_t b) {
+            uint64x2_t zero = vceqzq_f64(b);
+            return vbslq_f64(zero, vdupq_n_f64(0.0), vdivq_f64(a, b));
+        }
+#endif
+    };
+
+    struct Power {
+        static double scalar(double a, double b) { return std::pow(a, b); }
+    };
+
+    // Same operand order and nan behaviour as std::min and std::max
+    struct Minimum {
+        static double scalar(double a, double b) { return b < a ? b : a; }
+#if SIMD_X86
+        static __m128d sse2(__m128d a, __m128d b) { return _mm_min_pd(b, a); }
+        SIMD_AVX2 static __m256d avx2(__m256d a, __m256d b) { return _mm256_min_pd(b, a); }
+#elif SIMD_NEON
+        static float64x2_t neon(float64x2_t a, float64x2_t b) { return vbslq_f64(vcltq_f64(b, a), b, a); }
+#endif
+    };
+
+    struct Maximum {
+        static double scalar(double a, double b) { return a < b ? b : a; }
+#if SIMD_X86
+        static __m128d sse2(__m128d a, __m128d b) { return _mm_max_pd(b, a); }
+        SIMD_AVX2 static __m256d avx2(__m256d a, __m256d b) { return _mm256_max_pd(b, a); }
+#elif SIMD_NEON
+        static float64x2_t neon(float64x2_t a, float64x2_t b) { return vbslq_f64(vcltq_f64(a, b), b, a); }
+#endif
+    };
+
+    struct Atan2 {
+        static double scalar(double a, double b) { return std::atan2(a, b); }
+    };
+
+    // Overflow safe, a plain sqrt(a * a + b * b) would not be
+    struct Hypot {
+        static double scalar(double a, double b) { return std::hypot(a, b); }
+    };
+
+    // Comparison masks are turned into 1 or 0 by keeping the bits of 1.0
+    struct Less {
+        static double scalar(double a, double b) { return a < b ? 1.0 : 0.0; }
+#if SIMD_X86
+        static __m128d sse2(__m128d a, __m128d b) { return _mm_and_pd(_mm_cmplt_pd(a, b), _mm_set1_pd(1.0)); }
+        SIMD_AVX2 static __m256d avx2(__m256d a, __m256d b) { return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_LT_OQ), _mm256_set1_pd(1.0)); }
+#elif SIMD_NEON
+        static float64x2_t neon(float64x2_t a, float64x2_t b) { return vbslq_f64(vcltq_f64(a, b), vdupq_n_f64(1.0), vdupq_n_f64(0.0)); }
+#endif
+    };
+
+    struct LessEqual {
+        static double scalar(double a, double b) { return a <= b ? 1.0 : 0.0; }
+#if SIMD_X86
+        static __m128d sse2(__m128d a, __m128d b) { return _mm_and_pd(_mm_cmple_pd(a, b), _mm_set1_pd(1.0)); }
+        SIMD_AVX2 static __m256d avx2(__m256d a, __m256d b) { return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_LE_OQ), _mm256_set1_pd(1.0)); }
+#elif SIMD_NEON
+        static float64x2_t neon(float64x2_t a, float64x2_t b) { return vbslq_f64(vcleq_f64(a, b), vdupq_n_f64(1.0), vdupq_n_f64(0.0)); }
+#endif
+    };
+
+    struct Equal {
+        static double scalar(double a, double b) { return a == b ? 1.0 : 0.0; }
+#if SIMD_X86
+        static __m128d sse2(__m128d a, __m128d b) { return _mm_and_pd(_mm_cmpeq_pd(a, b), _mm_set1_pd(1.0)); }
+        SIMD_AVX2 static __m256d avx2(__m256d a, __m256d b) { return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ), _mm256_set1_pd(1.0)); }
+#elif SIMD_NEON
+        static float64x2_t neon(float64x2_t a, float64x2_t b) { return vbslq_f64(vceqq_f64(a, b), vdupq_n_f64(1.0), vdupq_n_f64(0.0)); }
+#endif
+    };
+
+    // Unordered, nan != x is true like in C
+    struct NotEqual {
+        static double scalar(double a, double b) { return a != b ? 1.0 : 0.0; }
+#if SIMD_X86
+        static __m128d sse2(__m128d a, __m128d b) { return _mm_and_pd(_mm_cmpneq_pd(a, b), _mm_set1_pd(1.0)); }
+        SIMD_AVX2 static __m256d avx2(__m256d a, __m256d b) { return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_NEQ_UQ), _mm256_set1_pd(1.0)); }
+#elif SIMD_NEON
+        static float64x2_t neon(float64x2_t a, float64x2_t b) { return vbslq_f64(vceqq_f64(a, b), vdupq_n_f64(0.0), vdupq_n_f64(1.0)); }
+#endif
+    };
+
+    struct LogicalAnd {
+        static double scalar(double a, double b) { return a != 0 && b != 0 ? 1.0 : 0.0; }
+#if SIMD_X86
+        static __m128d sse2(__m128d a, __m128d b) {
+            __m128d zero = _mm_setzero_pd();
+            return _mm_and_pd(_mm_and_pd(_mm_cmpneq_pd(a, zero), _mm_cmpneq_pd(b, zero)), _mm_set1_pd(1.0));
+        }
+        SIMD_AVX2 static __m256d avx2(__m256d a, __m256d b) {
+            __m256d zero = _mm256_setzero_pd();
+            __m256d both = _mm256_and_pd(_mm256_cmp_pd(a, zero, _CMP_NEQ_UQ), _mm256_cmp_pd(b, zero, _CMP_NEQ_UQ));
+            return _mm256_and_pd(both, _mm256_set1_pd(1.0));
+        }
+#elif SIMD_NEON
+        static float64x2_t neon(float64x2_t a, float64x2_t b) {
+            uint64x2_t either = vorrq_u64(vceqzq_f64(a), vceqzq_f64(b));
+            return vbslq_f64(either, vdupq_n_f64(0.0), vdupq_n_f64(1.0));
+        }
+#endif
+    };
+
+    struct LogicalOr {
+        static double scalar(double a, double b) { return a != 0 || b != 0 ? 1.0 : 0.0; }
+#if SIMD_X86
+        static __m128d sse2(__m128d a, __m128d b) {
+            __m128d zero = _mm_setzero_pd();
+            return _mm_and_pd(_mm_or_pd(_mm_cmpneq_pd(a, zero), _mm_cmpneq_pd(b, zero)), _mm_set1_pd(1.0));
+        }
+        SIMD_AVX2 static __m256d avx2(__m256d a, __m256d b) {
+            __m256d zero = _mm256_setzero_pd();
+            __m256d any = _mm256_or_pd(_mm256_cmp_pd(a, zero, _CMP_NEQ_UQ), _mm256_cmp_pd(b, zero, _CMP_NEQ_UQ));
+            return _mm256_and_pd(any, _mm256_set1_pd(1.0));
+        }
+#elif SIMD_NEON
+        static float64x2_t neon(float64x2_t a, float64x2_t b) {
+            uint64x2_t both = vandq_u64(vceqzq_f64(a), vceqzq_f64(b));
+            return vbslq_f64(both, vdupq_n_f64(0.0), vdupq_n_f64(1.0));
+        }
+#endif
+    };
+
+    // Both branches are already computed, only the lanes are picked
+    struct Select {
+        static double scalar(double a, double b, double c) { return a != 0 ? b : c; }
+#if SIMD_X86
+        static __m128d sse2(__m128d a, __m128d b, __m128d c) {
+            __m128d mask = _mm_cmpneq_pd(a, _mm_setzero_pd());
+            return _mm_or_pd(_mm_and_pd(mask, b), _mm_andnot_pd(mask, c));
+        }
+        SIMD_AVX2 static __m256d avx2(__m256d a, __m256d b, __m256d c) {
+            return _mm256_blendv_pd(c, b, _mm256_cmp_pd(a, _mm256_setzero_pd(), _CMP_NEQ_UQ));
+        }
+#elif SIMD_NEON
+        static float64x2_t neon(float64x2_t a, float64x2_t b, float64x2_t c) { return vbslq_f64(vceqzq_f64(a), c, b); }
+#endif
+    };
+
+    struct Negate {
+        static double scalar(double a) { return -a; }
+#if SIMD_X86
+        static __m128d sse2(__m128d a) { return _mm_xor_pd(a, _mm_set1_pd(-0.0)); }
+        SIMD_AVX2 static __m256d avx2(__m256d a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+#elif SIMD_NEON
+        static float64x2_t neon(float64x2_t a) { return vnegq_f64(a); }
+#endif
+    };
+
+    struct Abs {
+        static double scalar(double a) { return std::abs(a); }
+#if SIMD_X86
+        static __m128d sse2(__m128d a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a); }
+        SIMD_AVX2 static __m256d avx2(__m256d a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+#elif SIMD_NEON
+        static float64x2_t neon(float64x2_t a) { return vabsq_f64(a); }
+#endif
+    };
+
+    // Negative arguments yield 0
+    struct Sqrt {
+        static double scalar(double a) { return a < 0 ? 0.0 : std::sqrt(a); }
+#if SIMD_X86
+        static __m128d sse2(__m128d a) {
+            __m128d negative = _mm_cmplt_pd(a, _mm_setzero_pd());
+            return _mm_andnot_pd(negative, _mm_sqrt_pd(a));
+        }
+        SIMD_AVX2 static __m256d avx2(__m256d a) {
+            __m256d negative = _mm256_cmp_pd(a, _mm256_setzero_pd(), _CMP_LT_OQ);
+            return _mm256_andnot_pd(negative, _mm256_sqrt_pd(a));
+        }
+#elif SIMD_NEON
+        static float64x2_t neon(float64x2_t a) {
+            uint64x2_t negative = vcltzq_f64(a);
+            return vbslq_f64(negative, vdupq_n_f64(0.0), vsqrtq_f64(a));
+        }
+#endif
+    };
+
+    struct Root {
+        static double scalar(double a) { return std::sqrt(a); }
+#if SIMD_X86
+        static __m128d sse2(__m128d a) { return _mm_sqrt_pd(a); }
+        SIMD_AVX2 static __m256d avx2(__m256d a) { return _mm256_sqrt_pd(a); }
+#elif SIMD_NEON
+        static float64x2_t neon(float64x2_t a) { return vsqrtq_f64(a); }
+#endif
+    };
+
+    struct Sin {
+        static double scalar(double a) { return std::sin(a); }
+    };
+
+    struct Cos {
+        static double scalar(double a) { return std::cos(a); }
+    };
+
+    struct Tan {
+        static double scalar(double a) { return std::tan(a); }
+    };
+
+    struct Exp {
+        static double scalar(double a) { return std::exp(a); }
+    };
+
+    // Non-positive arguments yield 0
+    struct Log {
+        static double scalar(double a) { return a <= 0 ? 0.0 : std::log(a); }
+    };
+
+
+    // ***** Loops *****
+
+    template<class Op>
+    void binaryScalar(const double* a, const double* b, double* out, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            out[i] = Op::scalar(a[i], b[i]);
+        }
+    }
+
+    template<class Op>
+    void ternaryScalar(const double* a, const double* b, const double* c, double* out, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            out[i] = Op::scalar(a[i], b[i], c[i]);
+        }
+    }
+
+    template<class Op>
+    void unaryScalar(const double* a, double* out, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            out[i] = Op::scalar(a[i]);
+        }
+    }
+
+#if SIMD_X86
+    template<class Op>
+    void binarySSE2(const double* a, const double* b, double* out, std::size_t count) {
+        std::size_t i = 0;
+        for (; i + 2 <= count; i += 2) {
+            _mm_storeu_pd(out + i, Op::sse2(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        }
+        for (; i < count; ++i) {
+            out[i] = Op::scalar(a[i], b[i]);
+        }
+    }
+
+    template<class Op>
+    void ternarySSE2(const double* a, const double* b, const double* c, double* out, std::size_t count) {
+        std::size_t i = 0;
+        for (; i + 2 <= count; i += 2) {
+            _mm_storeu_pd(out + i, Op::sse2(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i), _mm_loadu_pd(c + i)));
+        }
+        for (; i < count; ++i) {
+            out[i] = Op::scalar(a[i], b[i], c[i]);
+        }
+    }
+
+    template<class Op>
+    void unarySSE2(const double* a, double* out, std::size_t count) {
+        std::size_t i = 0;
+        for (; i + 2 <= count; i += 2) {
+            _mm_storeu_pd(out + i, Op::sse2(_mm_loadu_pd(a + i)));
+        }
+        for (; i < count; ++i) {
+            out[i] = Op::scalar(a[i]);
+        }
+    }
+
+    template<class Op>
+    SIMD_AVX2 void binaryAVX2(const double* a, const double* b, double* out, std::size_t count) {
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            _mm256_storeu_pd(out + i, Op::avx2(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        }
+        for (; i < count; ++i) {
+            out[i] = Op::scalar(a[i], b[i]);
+        }
+    }
+
+    template<class Op>
+    SIMD_AVX2 void ternaryAVX2(const double* a, const double* b, const double* c, double* out, std::size_t count) {
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            _mm256_storeu_pd(out + i, Op::avx2(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), _mm256_loadu_pd(c + i)));
+        }
+        for (; i < count; ++i) {
+            out[i] = Op::scalar(a[i], b[i], c[i]);
+        }
+    }
+
+    template<class Op>
+    SIMD_AVX2 void unaryAVX2(const double* a, double* out, std::size_t count) {
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            _mm256_storeu_pd(out + i, Op::avx2(_mm256_loadu_pd(a + i)));
+        }
+        for (; i < count; ++i) {
+            out[i] = Op::scalar(a[i]);
+        }
+    }
+#elif SIMD_NEON
+    template<class Op>
+    void binaryNEON(const double* a, const double* b, double* out, std::size_t count) {
+        std::size_t i = 0;
+        for (; i + 2 <= count; i += 2) {
+            vst1q_f64(out + i, Op::neon(vld1q_f64(a + i), vld1q_f64(b + i)));
+        }
+        for (; i < count; ++i) {
+            out[i] = Op::scalar(a[i], b[i]);
+        }
+    }
+
+    template<class Op>
+    void ternaryNEON(const double* a, const double* b, const double* c, double* out, std::size_t count) {
+        std::size_t i = 0;
+        for (; i + 2 <= count; i += 2) {
+            vst1q_f64(out + i, Op::neon(vld1q_f64(a + i), vld1q_f64(b + i), vld1q_f64(c + i)));
+        }
+        for (; i < count; ++i) {
+            out[i] = Op::scalar(a[i], b[i], c[i]);
+        }
+    }
+
+    template<class Op>
+    void unaryNEON(const double* a, double* out, std::size_t count) {
+        std::size_t i = 0;
+        for (; i + 2 <= count; i += 2) {
+            vst1q_f64(out + i, Op::neon(vld1q_f64(a + i)));
+        }
+        for (; i < count; ++i) {
+            out[i] = Op::scalar(a[i]);
+        }
+    }
+#endif
+
+
+    // ***** Kernel tables *****
+
+    // The fast tier shares the exact kernels and swaps in the polynomial approximations
+    constexpr simd::Kernels fastTier(simd::Kernels kernels,
+                                     simd::UnaryKernel sin, simd::UnaryKernel cos, simd::UnaryKernel tan,
+                                     simd::UnaryKernel exp, simd::UnaryKernel log, simd::BinaryKernel power) {
+        kernels.sin = sin;
+        kernels.cos = cos;
+        kernels.tan = tan;
+        kernels.exp = exp;
+        kernels.log = log;
+        kernels.power = power;
+        return kernels;
+    }
+
+    struct KernelSet {
+        const simd::Kernels& precise;
+        const simd::Kernels& fast;
+    };
+
+    constexpr simd::Kernels scalarKernels = {
+        simd::Isa::Scalar,
+        binaryScalar<Add>,
+        binaryScalar<Subtract>,
+        binaryScalar<Multiply>,
+        binaryScalar<Divide>,
+        binaryScalar<Power>,
+        binaryScalar<Minimum>,
+        binaryScalar<Maximum>,
+        binaryScalar<Atan2>,
+        binaryScalar<Hypot>,
+        binaryScalar<Less>,
+        binaryScalar<LessEqual>,
+        binaryScalar<Equal>,
+        binaryScalar<NotEqual>,
+        binaryScalar<LogicalAnd>,
+        binaryScalar<LogicalOr>,
+        ternaryScalar<Select>,
+        unaryScalar<Negate>,
+        unaryScalar<Sin>,
+        unaryScalar<Cos>,
+        unaryScalar<Tan>,
+        unaryScalar<Sqrt>,
+        unaryScalar<Exp>,
+        unaryScalar<Log>,
+        unaryScalar<Abs>,
+        unaryScalar<Root>
+    };
+
+    constexpr simd::Kernels scalarFastKernels = fastTier(scalarKernels,
+        vmath::sinFast, vmath::cosFast, vmath::tanFast, vmath::expFast, vmath::logFast, vmath::powFast);
+
+#if SIMD_X86
+    constexpr simd::Kernels sse2Kernels = {
+        simd::Isa::SSE2,
+        binarySSE2<Add>,
+        binarySSE2<Subtract>,
+        binarySSE2<Multiply>,
+        binarySSE2<Divide>,
+        binaryScalar<Power>,
+        binarySSE2<Minimum>,
+        binarySSE2<Maximum>,
+        binaryScalar<Atan2>,
+        binaryScalar<Hypot>,
+        binarySSE2<Less>,
+        binarySSE2<LessEqual>,
+        binarySSE2<Equal>,
+        binarySSE2<NotEqual>,
+        binarySSE2<LogicalAnd>,
+        binarySSE2<LogicalOr>,
+        ternarySSE2<Select>,
+        unarySSE2<Negate>,
+        unaryScalar<Sin>,
+        unaryScalar<Cos>,
+        unaryScalar<Tan>,
+        unarySSE2<Sqrt>,
+        unaryScalar<Exp>,
+        unaryScalar<Log>,
+        unarySSE2<Abs>,
+        unarySSE2<Root>
+    };
+
+    constexpr simd::Kernels sse2FastKernels = fastTier(sse2Kernels,
+        vmath::sinFast, vmath::cosFast, vmath::tanFast, vmath::expFast, vmath::logFast, vmath::powFast);
+
+    constexpr simd::Kernels avx2Kernels = {
+        simd::Isa::AVX2,
+        binaryAVX2<Add>,
+        binaryAVX2<Subtract>,
+        binaryAVX2<Multiply>,
+        binaryAVX2<Divide>,
+        binaryScalar<Power>,
+        binaryAVX2<Minimum>,
+        binaryAVX2<Maximum>,
+        binaryScalar<Atan2>,
+        binaryScalar<Hypot>,
+        binaryAVX2<Less>,
+        binaryAVX2<LessEqual>,
+        binaryAVX2<Equal>,
+        binaryAVX2<NotEqual>,
+        binaryAVX2<LogicalAnd>,
+        binaryAVX2<LogicalOr>,
+        ternaryAVX2<Select>,
+        unaryAVX2<Negate>,
+        unaryScalar<Sin>,
+        unaryScalar<Cos>,
+        unaryScalar<Tan>,
+        unaryAVX2<Sqrt>,
+        unaryScalar<Exp>,
+        unaryScalar<Log>,
+        unaryAVX2<Abs>,
+        unaryAVX2<Root>
+    };
+
+    constexpr simd::Kernels avx2FastKernels = fastTier(avx2Kernels,
+        vmath::sinFastAVX2, vmath::cosFastAVX2, vmath::tanFastAVX2, vmath::expFastAVX2, vmath::logFastAVX2, vmath::powFastAVX2);
+#elif SIMD_NEON
+    constexpr simd::Kernels neonKernels = {
+        simd::Isa::NEON,
+        binaryNEON<Add>,
+        binaryNEON<Subtract>,
+        binaryNEON<Multiply>,
+        binaryNEON<Divide>,
+        binaryScalar<Power>,
+        binaryNEON<Minimum>,
+        binaryNEON<Maximum>,
+        binaryScalar<Atan2>,
+        binaryScalar<Hypot>,
+        binaryNEON<Less>,
+        binaryNEON<LessEqual>,
+        binaryNEON<Equal>,
+        binaryNEON<NotEqual>,
+        binaryNEON<LogicalAnd>,
+        binaryNEON<LogicalOr>,
+        ternaryNEON<Select>,
+        unaryNEON<Negate>,
+        unaryScalar<Sin>,
+        unaryScalar<Cos>,
+        unaryScalar<Tan>,
+        unaryNEON<Sqrt>,
+        unaryScalar<Exp>,
+        unaryScalar<Log>,
+        unaryNEON<Abs>,
+        unaryNEON<Root>
+    };
+
+    // NEON is the AArch64 baseline, the generic loops are vectorized for it by the compiler
+    constexpr simd::Kernels neonFastKernels = fastTier(neonKernels,
+        vmath::sinFast, vmath::cosFast, vmath::tanFast, vmath::expFast, vmath::logFast, vmath::powFast);
+#endif
+
+    KernelSet selectKernels() {
+#if SIMD_X86
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            return {avx2Kernels, avx2FastKernels};
+        }
+
+        // SSE2 is part of the x86-64 baseline
+        return {sse2Kernels, sse2FastKernels};
+#elif SIMD_NEON
+        // NEON is part of the AArch64 baseline
+        return {neonKernels, neonFastKernels};
+#else
+        return {scalarKernels, scalarFastKernels};
+#endif
+    }
+}
+
+
+namespace simd {
+
+    const Kernels& kernels(Accuracy accuracy) {
+        static const KernelSet selected = selectKernels();
+        return accuracy == Accuracy::Fast ? selected.fast : selected.precise;
+    }
+
+    const char* isaName(Isa isa) {
+        switch (isa) {
+            case Isa::Scalar:
+                return "Scalar";
+            case Isa::SSE2:
+                return "SSE2";
+            case Isa::AVX2:
+                return "AVX2";
+            case Isa::NEON:
+                return "NEON";
+        }
+        return "Unknown";
+    }
+
+    void fill(double value, double* out, std::size_t count) {
+        std::fill_n(out, count, value);
+    }
+
+}
@@ -0,0 +1,82 @@
+//
+//  Simd.hpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <cstddef>
+
+
+namespace simd {
+
+    enum class Isa {
+        Scalar,
+        SSE2,
+        AVX2,
+        NEON
+    };
+
+    // Precise uses libm for every lane, Fast uses the polynomial approximations of VectorMath
+    enum class Accuracy {
+        Precise,
+        Fast
+    };
+
+    using UnaryKernel = void (*)(const double* a, double* out, std::size_t count);
+    using BinaryKernel = void (*)(const double* a, const double* b, double* out, std::size_t count);
+    using TernaryKernel = void (*)(const double* a, const double* b, const double* c, double* out, std::size_t count);
+
+    /// @brief Lane kernels of the batch evaluator.
+    /// All kernels work on arrays of doubles (SoA), out may alias one of the inputs.
+    /// The transcendental kernels depend on the accuracy tier the table was selected for.
+    /// The guarded kernels (divide, sqrt, log) keep the semantics of the scalar evaluator.
+    /// Any value but 0, including nan, counts as true for the logic and select kernels.
+    struct Kernels {
+        Isa isa;
+
+        BinaryKernel add;
+        BinaryKernel subtract;
+        BinaryKernel multiply;
+        BinaryKernel divide;
+        BinaryKernel power;
+        BinaryKernel minimum;
+        BinaryKernel maximum;
+        BinaryKernel atan2;
+        BinaryKernel hypot;
+
+        // Comparisons and logic write 1 or 0
+        BinaryKernel less;
+        BinaryKernel lessEqual;
+        BinaryKernel equal;
+        BinaryKernel notEqual;
+        BinaryKernel logicalAnd;
+        BinaryKernel logicalOr;
+
+        // Per lane a != 0 ? b : c without branches
+        TernaryKernel select;
+
+        UnaryKernel negate;
+        UnaryKernel sin;
+        UnaryKernel cos;
+        UnaryKernel tan;
+        UnaryKernel sqrt;
+        UnaryKernel exp;
+        UnaryKernel log;
+        UnaryKernel abs;
+        UnaryKernel root;
+    };
+
+    // Selected once at runtime depending on the CPU, falls back to scalar loops
+    const Kernels& kernels(Accuracy accuracy = Accuracy::Precise);
+
+    const char* isaName(Isa isa);
+
+    void fill(double value, double* out, std::size_t count);
+
+}
+
+#endif // SIMD_HPP
@@ -0,0 +1,390 @@
+//
+//  StaticExpression.hpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#ifndef STATIC_EXPRESSION_HPP
+#define STATIC_EXPRESSION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "../parser/AST.hpp"
+#include "../parser/NativeCompiler.hpp"
+#include "Dual.hpp"
+
+
+/// @brief Expression templates for functions that are known at build time.
+/// sin(x * sin(t)) written with sx::Variable builds a type the compiler fully inlines, define()
+/// turns it into the same kernel entry points the native compiler produces, so a Function can
+/// use it without ever parsing or interpreting the expression.
+namespace sx {
+
+    // c * d, 0 where the coefficient is 0 so 0 * inf never appears
+    inline double scale(double c, double d) { return c != 0 ? c * d : 0.0; }
+
+    // Same semantics as the builtins of the parser, so both paths plot the same graph.
+    // The Dual overloads follow Program::evaluateDual
+    struct Add {
+        static constexpr std::string_view symbol = "+";
+        static constexpr Program::OpCode opCode = Program::OpCode::Add;
+        static double apply(double a, double b) { return a + b; }
+        static Dual apply(Dual a, Dual b) { return {a.value + b.value, a.derivative + b.derivative}; }
+    };
+
+    struct Subtract {
+        static constexpr std::string_view symbol = "-";
+        static constexpr Program::OpCode opCode = Program::OpCode::Subtract;
+        static double apply(double a, double b) { return a - b; }
+        static Dual apply(Dual a, Dual b) { return {a.value - b.value, a.derivative - b.derivative}; }
+    };
+
+    struct Multiply {
+        static constexpr std::string_view symbol = "*";
+        static constexpr Program::OpCode opCode = Program::OpCode::Multiply;
+        static double apply(double a, double b) { return a * b; }
+        static Dual apply(Dual a, Dual b) { return {a.value * b.value, b.value * a.derivative + scale(a.value, b.derivative)}; }
+    };
+
+    struct Divide {
+        static constexpr std::string_view symbol = "/";
+        static constexpr Program::OpCode opCode = Program::OpCode::Divide;
+        static double apply(double a, double b) { return b == 0 ? 0.0 : a / b; }
+        static Dual apply(Dual a, Dual b) {
+            if (b.value == 0) {
+                return {};
+            }
+            double r = a.value / b.value;
+            return {r, 1.0 / b.value * a.derivative + scale(-r / b.value, b.derivative)};
+        }
+    };
+
+    struct Power {
+        static constexpr std::string_view symbol = "^";
+        static constexpr Program::OpCode opCode = Program::OpCode::Power;
+        static double apply(double a, double b) { return std::pow(a, b); }
+        static Dual apply(Dual a, Dual b) {
+            double r = std::pow(a.value, b.value);
+            return {r, scale(a.derivative != 0 ? b.value * std::pow(a.value, b.value - 1) : 0.0, a.derivative) +
+                       scale(b.derivative != 0 ? r * std::log(a.value) : 0.0, b.derivative)};
+        }
+    };
+
+    struct Negate {
+        static constexpr std::string_view name = "-";
+        static constexpr Program::OpCode opCode = Program::OpCode::Negate;
+        static double apply(double a) { return -a; }
+        static Dual apply(Dual a) { return {-a.value, -a.derivative}; }
+    };
+
+    struct Sin {
+        static constexpr std::string_view name = "sin";
+        static constexpr Program::OpCode opCode = Program::OpCode::Sin;
+        static double apply(double a) { return std::sin(a); }
+        static Dual apply(Dual a) { return {std::sin(a.value), std::cos(a.value) * a.derivative}; }
+    };
+
+    struct Cos {
+        static constexpr std::string_view name = "cos";
+        static constexpr Program::OpCode opCode = Program::OpCode::Cos;
+        static double apply(double a) { return std::cos(a); }
+        static Dual apply(Dual a) { return {std::cos(a.value), -std::sin(a.value) * a.derivative}; }
+    };
+
+    struct Tan {
+        static constexpr std::string_view name = "tan";
+        static constexpr Program::OpCode opCode = Program::OpCode::Tan;
+        static double apply(double a) { return std::tan(a); }
+        static Dual apply(Dual a) {
+            double r = std::tan(a.value);
+            return {r, (1.0 + r * r) * a.derivative};
+        }
+    };
+
+    struct Sqrt {
+        static constexpr std::string_view name = "sqrt";
+        static constexpr Program::OpCode opCode = Program::OpCode::Sqrt;
+        static double apply(double a) { return a < 0 ? 0.0 : std::sqrt(a); }
+        static Dual apply(Dual a) {
+            double r = apply(a.value);
+            return {r, (r == 0 ? 0.0 : 0.5 / r) * a.derivative};
+        }
+    };
+
+    struct Exp {
+        static constexpr std::string_view name = "exp";
+        static constexpr Program::OpCode opCode = Program::OpCode::Exp;
+        static double apply(double a) { return std::exp(a); }
+        static Dual apply(Dual a) {
+            double r = std::exp(a.value);
+            return {r, r * a.derivative};
+        }
+    };
+
+    struct Log {
+        static constexpr std::string_view name = "log";
+        static constexpr Program::OpCode opCode = Program::OpCode::Log;
+        static double apply(double a) { return a <= 0 ? 0.0 : std::log(a); }
+        static Dual apply(Dual a) { return {apply(a.value), (a.value <= 0 ? 0.0 : 1.0 / a.value) * a.derivative}; }
+    };
+
+    struct Abs {
+        static constexpr std::string_view name = "abs";
+        static constexpr Program::OpCode opCode = Program::OpCode::Abs;
+        static double apply(double a) { return std::abs(a); }
+        static Dual apply(Dual a) { return {std::abs(a.value), (a.value > 0 ? 1.0 : a.value < 0 ? -1.0 : 0.0) * a.derivative}; }
+    };
+
+    struct Min {
+        static constexpr std::string_view name = "min";
+        static constexpr Program::OpCode opCode = Program::OpCode::Min;
+        static double apply(double a, double b) { return b < a ? b : a; }
+        static Dual apply(Dual a, Dual b) { return b.value < a.value ? b : a; }
+    };
+
+    struct Max {
+        static constexpr std::string_view name = "max";
+        static constexpr Program::OpCode opCode = Program::OpCode::Max;
+        static double apply(double a, double b) { return a < b ? b : a; }
+        static Dual apply(Dual a, Dual b) { return a.value < b.value ? b : a; }
+    };
+
+    struct Atan2 {
+        static constexpr std::string_view name = "atan2";
+        static constexpr Program::OpCode opCode = Program::OpCode::Atan2;
+        static double apply(double a, double b) { return std::atan2(a, b); }
+        static Dual apply(Dual a, Dual b) {
+            double norm = a.value * a.value + b.value * b.value;
+            if (norm == 0) {
+                return {apply(a.value, b.value), 0.0};
+            }
+            return {apply(a.value, b.value), b.value / norm * a.derivative + scale(-a.value / norm, b.derivative)};
+        }
+    };
+
+    struct Hypot {
+        static constexpr std::string_view name = "hypot";
+        static constexpr Program::OpCode opCode = Program::OpCode::Hypot;
+        static double apply(double a, double b) { return std::hypot(a, b); }
+        static Dual apply(Dual a, Dual b) {
+            double r = std::hypot(a.value, b.value);
+            if (r == 0) {
+                return {r, 0.0};
+            }
+            return {r, a.value / r * a.derivative + scale(b.value / r, b.derivative)};
+        }
+    };
+
+
+    template<class T>
+    concept Expression = std::remove_cvref_t<T>::isExpression;
+
+    template<class T>
+    concept Operand = Expression<T> || std::is_arithmetic_v<std::remove_cvref_t<T>>;
+
+
+    // Index of a parameter, in the order passed to define()
+    template<std::size_t Slot>
+    struct Variable {
+        static constexpr bool isExpression = true;
+        static constexpr std::size_t slotCount = Slot + 1;
+
+        double operator()(const double* s) const { return s[Slot]; }
+
+        Dual dual(const double* s, std::size_t slot) const { return {s[Slot], slot == Slot ? 1.0 : 0.0}; }
+
+        std::uint32_t compile(Program& program) const { return program.emitVariable(Slot); }
+
+        std::string toString(const std::vector<std::string>& names) const { return names[Slot]; }
+    };
+
+    struct Constant {
+        static constexpr bool isExpression = true;
+        static constexpr std::size_t slotCount = 0;
+
+        double value;
+
+        double operator()(const double*) const { return value; }
+
+        Dual dual(const double*, std::size_t) const { return {value, 0.0}; }
+
+        std::uint32_t compile(Program& program) const { return program.emitConstant(value); }
+
+        // Shortest form that reads back as the same double, the body is parsed again for its tree
+        std::string toString(const std::vector<std::string>&) const { return std::format("{}", value); }
+    };
+
+    template<class Op, class A>
+    struct Unary {
+        static constexpr bool isExpression = true;
+        static constexpr std::size_t slotCount = A::slotCount;
+
+        A argument;
+
+        double operator()(const double* s) const { return Op::apply(argument(s)); }
+
+        Dual dual(const double* s, std::size_t slot) const { return Op::apply(argument.dual(s, slot)); }
+
+        std::uint32_t compile(Program& program) const { return program.emit(Op::opCode, argument.compile(program)); }
+
+        std::string toString(const std::vector<std::string>& names) const {
+            return std::string(Op::name) + "(" + argument.toString(names) + ")";
+        }
+    };
+
+    template<class Op, class L, class R>
+    struct Binary {
+        static constexpr bool isExpression = true;
+        static constexpr std::size_t slotCount = std::max(L::slotCount, R::slotCount);
+
+        L left;
+        R right;
+
+        double operator()(const double* s) const { return Op::apply(left(s), right(s)); }
+
+        Dual dual(const double* s, std::size_t slot) const { return Op::apply(left.dual(s, slot), right.dual(s, slot)); }
+
+        std::uint32_t compile(Program& program) const {
+            std::uint32_t a = left.compile(program);
+            return program.emit(Op::opCode, a, right.compile(program));
+        }
+
+        std::string toString(const std::vector<std::string>& names) const {
+            return "(" + left.toString(names) + " " + std::string(Op::symbol) + " " + right.toString(names) + ")";
+        }
+    };
+
+
+    // Binary builtin written as a call, min(a, b) instead of a min b
+    template<class Op, class L, class R>
+    struct Call : Binary<Op, L, R> {
+        std::string toString(const std::vector<std::string>& names) const {
+            return std::string(Op::name) + "(" + this->left.toString(names) + ", " + this->right.toString(names) + ")";
+        }
+    };
+
+
+    template<Operand T>
+    constexpr auto lift(T value) {
+        if constexpr (Expression<T>) {
+            return value;
+        } else {
+            return Constant{static_cast<double>(value)};
+        }
+    }
+
+    template<class Op, Operand L, Operand R>
+    constexpr auto binary(L left, R right) {
+        return Binary<Op, decltype(lift(left)), decltype(lift(right))>{lift(left), lift(right)};
+    }
+
+    template<Operand L, Operand R> requires (Expression<L> || Expression<R>)
+    constexpr auto operator+(L left, R right) { return binary<Add>(left, right); }
+
+    template<Operand L, Operand R> requires (Expression<L> || Expression<R>)
+    constexpr auto operator-(L left, R right) { return binary<Subtract>(left, right); }
+
+    template<Operand L, Operand R> requires (Expression<L> || Expression<R>)
+    constexpr auto operator*(L left, R right) { return binary<Multiply>(left, right); }
+
+    template<Operand L, Operand R> requires (Expression<L> || Expression<R>)
+    constexpr auto operator/(L left, R right) { return binary<Divide>(left, right); }
+
+    template<Operand L, Operand R> requires (Expression<L> || Expression<R>)
+    constexpr auto pow(L left, R right) { return binary<Power>(left, right); }
+
+    template<class Op, Operand L, Operand R>
+    constexpr auto call(L left, R right) {
+        return Call<Op, decltype(lift(left)), decltype(lift(right))>{{lift(left), lift(right)}};
+    }
+
+    template<Operand L, Operand R> requires (Expression<L> || Expression<R>)
+    constexpr auto min(L left, R right) { return call<Min>(left, right); }
+
+    template<Operand L, Operand R> requires (Expression<L> || Expression<R>)
+    constexpr auto max(L left, R right) { return call<Max>(left, right); }
+
+    template<Operand L, Operand R> requires (Expression<L> || Expression<R>)
+    constexpr auto atan2(L left, R right) { return call<Atan2>(left, right); }
+
+    template<Operand L, Operand R> requires (Expression<L> || Expression<R>)
+    constexpr auto hypot(L left, R right) { return call<Hypot>(left, right); }
+
+    template<Operand X, Operand L, Operand H> requires (Expression<X> || Expression<L> || Expression<H>)
+    constexpr auto clamp(X x, L low, H high) { return min(max(lift(x), lift(low)), lift(high)); }
+
+    template<Expression A> constexpr auto operator-(A a) { return Unary<Negate, A>{a}; }
+
+    template<Expression A> constexpr auto sin(A a) { return Unary<Sin, A>{a}; }
+    template<Expression A> constexpr auto cos(A a) { return Unary<Cos, A>{a}; }
+    template<Expression A> constexpr auto tan(A a) { return Unary<Tan, A>{a}; }
+    template<Expression A> constexpr auto sqrt(A a) { return Unary<Sqrt, A>{a}; }
+    template<Expression A> constexpr auto exp(A a) { return Unary<Exp, A>{a}; }
+    template<Expression A> constexpr auto log(A a) { return Unary<Log, A>{a}; }
+    template<Expression A> constexpr auto abs(A a) { return Unary<Abs, A>{a}; }
+
+
+    // Kernel entry points with the signatures of NativeKernel, one instantiation per expression
+    template<auto E>
+    double evaluate(const double* slots) {
+        return E(slots);
+    }
+
+    template<auto E>
+    void evaluateBatch(const double* xs, double* ys, std::size_t count, const double* slots, std::size_t slot) {
+        double s[Context::capacity];
+        std::copy_n(slots, Context::capacity, s);
+
+        for (std::size_t i = 0; i < count; ++i) {
+            s[slot] = xs[i];
+            ys[i] = E(s);
+        }
+    }
+
+    template<auto E>
+    double evaluateDual(const double* slots, std::size_t slot, double* derivative) {
+        Dual result = E.dual(slots, slot);
+        *derivative = result.derivative;
+
+        return result.value;
+    }
+
+
+    struct Definition {
+        std::vector<std::string> parameters;
+        std::string body;
+
+        NativeKernel::Evaluate evaluate;
+        NativeKernel::EvaluateBatch evaluateBatch;
+        NativeKernel::EvaluateDual evaluateDual;
+
+        // Same expression for the interpreter, e.g. to splice it into expressions that call it
+        Program program;
+    };
+
+    // The variables of E are the parameters in the given order, Variable<0> is parameters[0]
+    template<auto E>
+    Definition define(const std::vector<std::string>& parameters) {
+        static_assert(decltype(E)::slotCount <= Context::capacity, "Static expression uses too many variables");
+
+        if (parameters.size() < decltype(E)::slotCount) {
+            throw std::invalid_argument("Static expression uses more variables than parameters");
+        }
+
+        Definition definition{parameters, E.toString(parameters), &evaluate<E>, &evaluateBatch<E>, &evaluateDual<E>, {}};
+        definition.program.compile(E);
+
+        return definition;
+    }
+
+}
+
+#endif // STATIC_EXPRESSION_HPP
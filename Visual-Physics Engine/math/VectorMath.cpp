@@ -0,0 +1,232 @@
+//
+//  VectorMath.cpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#include "VectorMath.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__GNUC__)
+    #define VMATH_INLINE [[gnu::always_inline]] inline
+#else
+    #define VMATH_INLINE inline
+#endif
+
+
+namespace {
+
+    // Adding and subtracting 1.5 * 2^52 rounds to the nearest integer, which then sits in the low mantissa bits
+    constexpr double roundMagic = 0x1.8p52;
+
+    constexpr double twoOverPi = 6.36619772367581382433e-01;
+    constexpr double pio2Hi = 1.57079632673412561417e+00;
+    constexpr double pio2Mid = 6.07710050630396597660e-11;
+    constexpr double pio2Lo = 2.02226624879595063154e-21;
+
+    constexpr double log2e = 1.44269504088896338700e+00;
+    constexpr double ln2Hi = 6.93147180369123816490e-01;
+    constexpr double ln2Lo = 1.90821492927058770002e-10;
+    constexpr double sqrt2 = 1.41421356237309504880e+00;
+
+    // Beyond these arguments the lanes are recomputed with libm
+    constexpr double trigLimit = 1e5;
+    constexpr double expLimit = 700.0;
+
+    constexpr std::size_t chunk = 64;
+
+
+    VMATH_INLINE std::uint64_t bits(double x) { return std::bit_cast<std::uint64_t>(x); }
+    VMATH_INLINE double fromBits(std::uint64_t x) { return std::bit_cast<double>(x); }
+
+    // Branch free select, mask is either all ones (a) or all zeros (b)
+    VMATH_INLINE double select(std::uint64_t mask, double a, double b) {
+        return fromBits((bits(a) & mask) | (bits(b) & ~mask));
+    }
+
+    // Reduces x to [-pi/4, pi/4], the quadrant ends up in the lowest two bits
+    VMATH_INLINE double reduce(double x, std::uint64_t& quadrant) {
+        double kd = x * twoOverPi + roundMagic;
+        quadrant = bits(kd);
+
+        double k = kd - roundMagic;
+        return ((x - k * pio2Hi) - k * pio2Mid) - k * pio2Lo;
+    }
+
+    VMATH_INLINE double sinPolynomial(double r) {
+        double z = r * r;
+        return r + r * z * (-1.0 / 6 + z * (1.0 / 120 + z * (-1.0 / 5040 + z * (1.0 / 362880 + z * (-1.0 / 39916800)))));
+    }
+
+    VMATH_INLINE double cosPolynomial(double r) {
+        double z = r * r;
+        return 1.0 + z * (-1.0 / 2 + z * (1.0 / 24 + z * (-1.0 / 720 + z * (1.0 / 40320 + z * (-1.0 / 3628800 + z * (1.0 / 479001600))))));
+    }
+
+    VMATH_INLINE double sinKernel(double x) {
+        std::uint64_t quadrant;
+        double r = reduce(x, quadrant);
+
+        double s = sinPolynomial(r);
+        double c = cosPolynomial(r);
+
+        double value = select(0 - (quadrant & 1), c, s);
+        return fromBits(bits(value) ^ ((quadrant & 2) << 62));
+    }
+
+    VMATH_INLINE double cosKernel(double x) {
+        std::uint64_t quadrant;
+        double r = reduce(x, quadrant);
+
+        double s = sinPolynomial(r);
+        double c = cosPolynomial(r);
+
+        double value = select(0 - (quadrant & 1), s, c);
+        return fromBits(bits(value) ^ (((quadrant + 1) & 2) << 62));
+    }
+
+    VMATH_INLINE double tanKernel(double x) {
+        std::uint64_t quadrant;
+        double r = reduce(x, quadrant);
+
+        double s = sinPolynomial(r);
+        double c = cosPolynomial(r);
+
+        std::uint64_t odd = 0 - (quadrant & 1);
+        return select(odd, -c, s) / select(odd, s, c);
+    }
+
+    VMATH_INLINE double expKernel(double x) {
+        double kd = x * log2e + roundMagic;
+        double k = kd - roundMagic;
+        double r = (x - k * ln2Hi) - k * ln2Lo;
+
+        double p = 1.0 + r * (1.0 + r * (1.0 / 2 + r * (1.0 / 6 + r * (1.0 / 24 + r * (1.0 / 120 + r * (1.0 / 720
+                 + r * (1.0 / 5040 + r * (1.0 / 40320 + r * (1.0 / 362880 + r * (1.0 / 3628800))))))))));
+
+        // Scale by 2^k directly in the exponent bits
+        std::uint64_t exponent = bits(kd) - bits(roundMagic);
+        return fromBits(bits(p) + (exponent << 52));
+    }
+
+    VMATH_INLINE double logKernel(double x) {
+        std::uint64_t b = bits(x);
+
+        // x = m * 2^e with m in [1, 2), the exponent is converted to double with the same magic trick
+        double e = fromBits((b >> 52) | bits(0x1p52)) - (0x1p52 + 1023.0);
+        double m = fromBits((b & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+
+        // Center m around 1 to keep |s| small, m > sqrt(2) is decided on the mantissa bits
+        std::uint64_t high = 0 - static_cast<std::uint64_t>(bits(m) > bits(sqrt2));
+        m = select(high, m * 0.5, m);
+        e = select(high, e + 1.0, e);
+
+        double f = m - 1.0;
+        double s = f / (2.0 + f);
+        double z = s * s;
+
+        double p = 2.0 * s * (1.0 + z * (1.0 / 3 + z * (1.0 / 5 + z * (1.0 / 7 + z * (1.0 / 9 + z * (1.0 / 11 + z * (1.0 / 13)))))));
+
+        return e * ln2Hi + (e * ln2Lo + p);
+    }
+
+
+    VMATH_INLINE bool trigInRange(double x) { return std::abs(x) <= trigLimit; }
+    VMATH_INLINE bool expInRange(double x) { return std::abs(x) <= expLimit; }
+    VMATH_INLINE bool logInRange(double x) { return x >= 0x1p-1022 && x <= 0x1.fffffffffffffp1023; }
+
+    double exactSin(double x) { return std::sin(x); }
+    double exactCos(double x) { return std::cos(x); }
+    double exactTan(double x) { return std::tan(x); }
+    double exactExp(double x) { return std::exp(x); }
+    double exactLog(double x) { return x <= 0 ? 0.0 : std::log(x); }
+
+
+    // Works on fixed chunks so the inner loop has a constant trip count, out may alias a
+    template<double (*Kernel)(double), bool (*InRange)(double), double (*Exact)(double)>
+    VMATH_INLINE void unaryLoop(const double* a, double* out, std::size_t count) {
+        double in[chunk];
+        double result[chunk];
+
+        for (std::size_t offset = 0; offset < count; offset += chunk) {
+            std::size_t n = std::min(chunk, count - offset);
+
+            std::copy_n(a + offset, n, in);
+            std::fill(in + n, in + chunk, 0.0);
+
+            for (std::size_t i = 0; i < chunk; ++i) {
+                result[i] = Kernel(in[i]);
+            }
+
+            for (std::size_t i = 0; i < n; ++i) {
+                if (!InRange(in[i])) {
+                    result[i] = Exact(in[i]);
+                }
+            }
+
+            std::copy_n(result, n, out + offset);
+        }
+    }
+
+    VMATH_INLINE void powLoop(const double* a, const double* b, double* out, std::size_t count) {
+        double base[chunk];
+        double exponent[chunk];
+        double product[chunk];
+        double result[chunk];
+
+        for (std::size_t offset = 0; offset < count; offset += chunk) {
+            std::size_t n = std::min(chunk, count - offset);
+
+            std::copy_n(a + offset, n, base);
+            std::copy_n(b + offset, n, exponent);
+            std::fill(base + n, base + chunk, 1.0);
+            std::fill(exponent + n, exponent + chunk, 0.0);
+
+            // a^b = exp(b * log(a)) for positive a
+            for (std::size_t i = 0; i < chunk; ++i) {
+                product[i] = exponent[i] * logKernel(base[i]);
+            }
+
+            for (std::size_t i = 0; i < chunk; ++i) {
+                result[i] = expKernel(product[i]);
+            }
+
+            // Negative or special bases and overflowing results go through libm
+            for (std::size_t i = 0; i < n; ++i) {
+                if (!logInRange(base[i]) || !expInRange(product[i])) {
+                    result[i] = std::pow(base[i], exponent[i]);
+                }
+            }
+
+            std::copy_n(result, n, out + offset);
+        }
+    }
+}
+
+
+namespace vmath {
+
+    void sinFast(const double* a, double* out, std::size_t count) { unaryLoop<sinKernel, trigInRange, exactSin>(a, out, count); }
+    void cosFast(const double* a, double* out, std::size_t count) { unaryLoop<cosKernel, trigInRange, exactCos>(a, out, count); }
+    void tanFast(const double* a, double* out, std::size_t count) { unaryLoop<tanKernel, trigInRange, exactTan>(a, out, count); }
+    void expFast(const double* a, double* out, std::size_t count) { unaryLoop<expKernel, expInRange, exactExp>(a, out, count); }
+    void logFast(const double* a, double* out, std::size_t count) { unaryLoop<logKernel, logInRange, exactLog>(a, out, count); }
+    void powFast(const double* a, const double* b, double* out, std::size_t count) { powLoop(a, b, out, count); }
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define VMATH_AVX2 __attribute__((target("avx2,fma")))
+
+    VMATH_AVX2 void sinFastAVX2(const double* a, double* out, std::size_t count) { unaryLoop<sinKernel, trigInRange, exactSin>(a, out, count); }
+    VMATH_AVX2 void cosFastAVX2(const double* a, double* out, std::size_t count) { unaryLoop<cosKernel, trigInRange, exactCos>(a, out, count); }
+    VMATH_AVX2 void tanFastAVX2(const double* a, double* out, std::size_t count) { unaryLoop<tanKernel, trigInRange, exactTan>(a, out, count); }
+    VMATH_AVX2 void expFastAVX2(const double* a, double* out, std::size_t count) { unaryLoop<expKernel, expInRange, exactExp>(a, out, count); }
+    VMATH_AVX2 void logFastAVX2(const double* a, double* out, std::size_t count) { unaryLoop<logKernel, logInRange, exactLog>(a, out, count); }
+    VMATH_AVX2 void powFastAVX2(const double* a, const double* b, double* out, std::size_t count) { powLoop(a, b, out, count); }
+#endif
+
+}
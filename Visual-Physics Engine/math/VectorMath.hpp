@@ -0,0 +1,40 @@
+//
+//  VectorMath.hpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#ifndef VECTOR_MATH_HPP
+#define VECTOR_MATH_HPP
+
+#include <cstddef>
+
+
+/// @brief Array versions of the transcendental builtins for the fast accuracy tier.
+/// The loops are branch free polynomial approximations that the compiler vectorizes,
+/// the relative error stays below 1e-9 which is far below one pixel of any plot.
+/// Lanes outside of the approximated range (huge arguments, inf, nan, denormals) are
+/// recomputed with libm afterwards, so the guarded semantics of the builtins are kept.
+namespace vmath {
+
+    void sinFast(const double* a, double* out, std::size_t count);
+    void cosFast(const double* a, double* out, std::size_t count);
+    void tanFast(const double* a, double* out, std::size_t count);
+    void expFast(const double* a, double* out, std::size_t count);
+    void logFast(const double* a, double* out, std::size_t count);
+    void powFast(const double* a, const double* b, double* out, std::size_t count);
+
+#if defined(__x86_64__) || defined(_M_X64)
+    // Same loops compiled for AVX2 and FMA, only called when the CPU supports both
+    void sinFastAVX2(const double* a, double* out, std::size_t count);
+    void cosFastAVX2(const double* a, double* out, std::size_t count);
+    void tanFastAVX2(const double* a, double* out, std::size_t count);
+    void expFastAVX2(const double* a, double* out, std::size_t count);
+    void logFastAVX2(const double* a, double* out, std::size_t count);
+    void powFastAVX2(const double* a, const double* b, double* out, std::size_t count);
+#endif
+
+}
+
+#endif // VECTOR_MATH_HPP
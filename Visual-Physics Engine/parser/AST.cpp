@@ -7,14 +7,24 @@
 
 #include "AST.hpp"
 
+#include <algorithm>
 #include <unordered_map>
 #include <cmath>
+#include <stdexcept>
 
+#include "Program.hpp"
 
 
-double BinaryOperationNode::evaluate(const Environment& env) const {
-    double leftValue = left->evaluate(env);
-    double rightValue = right->evaluate(env);
+namespace {
+
+    // Indexed by Condition
+    constexpr std::array<std::string_view, 8> conditionSymbols = {"<", "<=", ">", ">=", "==", "!=", "&&", "||"};
+}
+
+
+double BinaryOperationNode::evaluate(const Context& context) const {
+    double leftValue = left->evaluate(context);
+    double rightValue = right->evaluate(context);
 
     switch (operation) {
         case '+':
@@ -35,81 +45,443 @@ double BinaryOperationNode::evaluate(const Environment& env) const {
     }
 }
 
-double VariableNode::evaluate(const Environment& env) const {
-    auto it = env.find(m_name);
-    if (it != env.end()) {
-        
-        if (m_negative)
-            return -it->second;
-        else
-            return it->second;
-        
-    } else {
-        throw std::runtime_error("Variable not found: " + m_name);
+std::uint32_t BinaryOperationNode::compile(Program& program) const {
+    std::uint32_t leftRegister = left->compile(program);
+    std::uint32_t rightRegister = right->compile(program);
+
+    switch (operation) {
+        case '+':
+            return program.emit(Program::OpCode::Add, leftRegister, rightRegister);
+        case '-':
+            return program.emit(Program::OpCode::Subtract, leftRegister, rightRegister);
+        case '*':
+            return program.emit(Program::OpCode::Multiply, leftRegister, rightRegister);
+        case '/':
+            return program.emit(Program::OpCode::Divide, leftRegister, rightRegister);
+        case '^':
+            return program.emit(Program::OpCode::Power, leftRegister, rightRegister);
+        default:
+            throw std::runtime_error("Unknown operation");
     }
 }
 
-double ConstantNode::evaluate(const Environment& env) const {
+ASTNode* BinaryOperationNode::substitute(Arena& arena, std::span<ASTNode* const> arguments) const {
+    ASTNode* leftCopy = left->substitute(arena, arguments);
+    ASTNode* rightCopy = right->substitute(arena, arguments);
+
+    return arena.make<BinaryOperationNode>(leftCopy, rightCopy, operation);
+}
+
+double VariableNode::evaluate(const Context& context) const {
+    if (m_negative)
+        return -context[m_slot];
+    else
+        return context[m_slot];
+}
+
+std::uint32_t VariableNode::compile(Program& program) const {
+    std::uint32_t variable = program.emitVariable(m_slot);
+
+    return m_negative ? program.emit(Program::OpCode::Negate, variable) : variable;
+}
+
+ASTNode* VariableNode::substitute(Arena& arena, std::span<ASTNode* const> arguments) const {
+    if (m_slot >= arguments.size()) {
+        return arena.make<VariableNode>(arena.intern(m_name), m_slot, m_negative);
+    }
+
+    // Every use gets its own copy, the optimizer rewrites nodes in place
+    ASTNode* argument = arguments[m_slot]->clone(arena);
+
+    return m_negative ? arena.make<NegationNode>(argument) : argument;
+}
+
+double ConstantNode::evaluate(const Context&) const {
     return value;
 }
 
-FunctionNode::FunctionNode(const std::string& func, std::unique_ptr<ASTNode> arg)
-    : argument(std::move(arg)), functionName(func) {}
+std::uint32_t ConstantNode::compile(Program& program) const {
+    return program.emitConstant(value);
+}
+
+ASTNode* ConstantNode::substitute(Arena& arena, std::span<ASTNode* const>) const {
+    return arena.make<ConstantNode>(value);
+}
 
-double FunctionNode::evaluate(const Environment& env) const {
-    double argValue = argument->evaluate(env);
+FunctionNode::FunctionNode(Builtin func, ASTNode* arg)
+    : function(func), argument(arg) {}
 
-    if (functionMap.find(functionName) == functionMap.end()) {
-        
-        throw std::runtime_error("Function not found: " + functionName);
-        
+double FunctionNode::evaluate(const Context& context) const {
+    return builtinInfo(function).function(argument->evaluate(context));
+}
+
+std::uint32_t FunctionNode::compile(Program& program) const {
+    return program.emit(Program::opCode(function), argument->compile(program));
+}
+
+ASTNode* FunctionNode::substitute(Arena& arena, std::span<ASTNode* const> arguments) const {
+    return arena.make<FunctionNode>(function, argument->substitute(arena, arguments));
+}
+
+double ConditionNode::evaluate(const Context& context) const {
+    double a = left->evaluate(context);
+    double b = right->evaluate(context);
+
+    bool result = false;
+
+    switch (condition) {
+        case Condition::Less:
+            result = a < b;
+            break;
+        case Condition::LessEqual:
+            result = a <= b;
+            break;
+        case Condition::Greater:
+            result = a > b;
+            break;
+        case Condition::GreaterEqual:
+            result = a >= b;
+            break;
+        case Condition::Equal:
+            result = a == b;
+            break;
+        case Condition::NotEqual:
+            result = a != b;
+            break;
+        case Condition::And:
+            result = a != 0 && b != 0;
+            break;
+        case Condition::Or:
+            result = a != 0 || b != 0;
+            break;
+    }
+
+    return result ? 1.0 : 0.0;
+}
+
+std::uint32_t ConditionNode::compile(Program& program) const {
+    std::uint32_t a = left->compile(program);
+    std::uint32_t b = right->compile(program);
+
+    // a > b is b < a, so the program only needs half of the comparisons
+    switch (condition) {
+        case Condition::Less:
+            return program.emit(Program::OpCode::Less, a, b);
+        case Condition::LessEqual:
+            return program.emit(Program::OpCode::LessEqual, a, b);
+        case Condition::Greater:
+            return program.emit(Program::OpCode::Less, b, a);
+        case Condition::GreaterEqual:
+            return program.emit(Program::OpCode::LessEqual, b, a);
+        case Condition::Equal:
+            return program.emit(Program::OpCode::Equal, a, b);
+        case Condition::NotEqual:
+            return program.emit(Program::OpCode::NotEqual, a, b);
+        case Condition::And:
+            return program.emit(Program::OpCode::And, a, b);
+        case Condition::Or:
+            return program.emit(Program::OpCode::Or, a, b);
+    }
+
+    throw std::runtime_error("Unknown condition");
+}
+
+ASTNode* ConditionNode::substitute(Arena& arena, std::span<ASTNode* const> arguments) const {
+    ASTNode* leftCopy = left->substitute(arena, arguments);
+    ASTNode* rightCopy = right->substitute(arena, arguments);
+
+    return arena.make<ConditionNode>(leftCopy, rightCopy, condition);
+}
+
+std::string ConditionNode::toString() const {
+    return "(" + left->toString() + " " + std::string(symbol(condition)) + " " + right->toString() + ")";
+}
+
+std::optional<Condition> ConditionNode::fromSymbol(std::string_view symbol) {
+    for (std::size_t i = 0; i < conditionSymbols.size(); ++i) {
+        if (conditionSymbols[i] == symbol) {
+            return static_cast<Condition>(i);
+        }
+    }
+
+    return std::nullopt;
+}
+
+std::string_view ConditionNode::symbol(Condition condition) {
+    return conditionSymbols[static_cast<std::size_t>(condition)];
+}
+
+template<std::size_t Arity>
+double CallNode<Arity>::evaluate(const Context& context) const {
+    const BuiltinInfo& info = builtinInfo(function);
+
+    if constexpr (Arity == 2) {
+        return info.binary(arguments[0]->evaluate(context), arguments[1]->evaluate(context));
     } else {
-        
-        return functionMap.at(functionName)(argValue);
+        return info.ternary(arguments[0]->evaluate(context), arguments[1]->evaluate(context), arguments[2]->evaluate(context));
     }
 }
 
-double FunctionHeaderNode::evaluate(const Environment& env) const {
-    return body ? body->evaluate(env) : 0.0;
+template<std::size_t Arity>
+std::uint32_t CallNode<Arity>::compile(Program& program) const {
+    std::array<std::uint32_t, Arity> registers;
+
+    for (std::size_t i = 0; i < Arity; ++i) {
+        registers[i] = arguments[i]->compile(program);
+    }
+
+    if constexpr (Arity == 3) {
+        if (function == Builtin::If) {
+            return program.emit(Program::OpCode::Select, registers[0], registers[1], registers[2]);
+        }
+
+        // clamp has no instruction of its own
+        std::uint32_t low = program.emit(Program::OpCode::Max, registers[0], registers[1]);
+        return program.emit(Program::OpCode::Min, low, registers[2]);
+    } else {
+        return program.emit(Program::opCode(function), registers[0], registers[1]);
+    }
+}
+
+template<std::size_t Arity>
+ASTNode* CallNode<Arity>::substitute(Arena& arena, std::span<ASTNode* const> replacements) const {
+    std::array<ASTNode*, Arity> copies;
+
+    for (std::size_t i = 0; i < Arity; ++i) {
+        copies[i] = arguments[i]->substitute(arena, replacements);
+    }
+
+    return arena.make<CallNode<Arity>>(function, copies);
+}
+
+template<std::size_t Arity>
+std::string CallNode<Arity>::toString() const {
+    std::string result = std::string(builtinInfo(function).name) + "(";
+
+    for (std::size_t i = 0; i < Arity; ++i) {
+        result += (i == 0 ? "" : ", ") + arguments[i]->toString();
+    }
+
+    return result + ")";
+}
+
+template struct CallNode<2>;
+template struct CallNode<3>;
+
+double SeriesNode::evaluate(const Context& context) const {
+    double from = std::round(first->evaluate(context));
+    double to = std::round(last->evaluate(context));
+
+    // Same limit as in compile, the optimizer folds constant series through this
+    if (to - from + 1 > maxTerms) {
+        throw std::runtime_error("Too many terms in " + std::string(builtinInfo(function).name));
+    }
+
+    bool sum = function == Builtin::Sum;
+    double result = sum ? 0.0 : 1.0;
+
+    Context local = context;
+
+    for (double k = from; k <= to; ++k) {
+        local[index->m_slot] = k;
+
+        double value = term->evaluate(local);
+        result = sum ? result + value : result * value;
+    }
+
+    return result;
+}
+
+std::uint32_t SeriesNode::compile(Program& program) const {
+    auto* from = dynamic_cast<const ConstantNode*>(first);
+    auto* to = dynamic_cast<const ConstantNode*>(last);
+
+    std::string name(builtinInfo(function).name);
+
+    if (!from || !to) {
+        throw std::runtime_error("Bounds of " + name + " have to be constant");
+    }
+
+    double a = std::round(from->value);
+    double b = std::round(to->value);
+
+    // Empty, also for nan bounds
+    if (!(a <= b)) {
+        return program.emitConstant(function == Builtin::Sum ? 0.0 : 1.0);
+    }
+
+    if (b - a + 1 > maxTerms) {
+        throw std::runtime_error("Too many terms in " + name);
+    }
+
+    Program::OpCode reduction = function == Builtin::Sum ? Program::OpCode::Sum : Program::OpCode::Product;
+    return program.emitSeries(reduction, index->m_slot, a, b, *term);
+}
+
+ASTNode* SeriesNode::substitute(Arena& arena, std::span<ASTNode* const> arguments) const {
+    // Inlining passes a variable of the caller for the index, never an expression
+    auto* indexCopy = dynamic_cast<VariableNode*>(index->substitute(arena, arguments));
+
+    if (!indexCopy) {
+        throw std::runtime_error("Index of " + std::string(builtinInfo(function).name) + " replaced by an expression");
+    }
+
+    ASTNode* firstCopy = first->substitute(arena, arguments);
+    ASTNode* lastCopy = last->substitute(arena, arguments);
+    ASTNode* termCopy = term->substitute(arena, arguments);
+
+    return arena.make<SeriesNode>(function, indexCopy, firstCopy, lastCopy, termCopy);
+}
+
+std::string SeriesNode::toString() const {
+    return std::string(builtinInfo(function).name) + "(" + index->toString() + ", " + first->toString() + ", " +
+           last->toString() + ", " + term->toString() + ")";
+}
+
+double FunctionHeaderNode::evaluate(const Context& context) const {
+    return body ? body->evaluate(context) : 0.0;
+}
+
+std::uint32_t FunctionHeaderNode::compile(Program& program) const {
+    return body ? body->compile(program) : program.emitConstant(0.0);
+}
+
+ASTNode* FunctionHeaderNode::substitute(Arena& arena, std::span<ASTNode* const> arguments) const {
+    ASTNode* bodyCopy = body ? body->substitute(arena, arguments) : nullptr;
+
+    auto* header = arena.make<FunctionHeaderNode>(arena.intern(name), arena.internAll(parameters), bodyCopy);
+    header->setVariables(arena.internAll(variables));
+    return header;
 }
 
 std::string FunctionHeaderNode::toString() const {
     std::string params;
     for (const auto& param : parameters) {
-        params += (params.empty() ? "" : ", ") + param;
+        params += (params.empty() ? "" : ", ") + std::string(param);
     }
-    return "function " + name + "(" + params + ") = " + (body ? body->toString() : "void");
+    return "function " + std::string(name) + "(" + params + ") = " + (body ? body->toString() : "void");
 }
 
-void FunctionHeaderNode::setBody(std::unique_ptr<ASTNode> newBody) {
-    body = std::move(newBody);
+void FunctionHeaderNode::setBody(ASTNode* newBody) {
+    body = newBody;
 }
 
 std::size_t FunctionHeaderNode::getParameterCount() const {
     return parameters.size();
 }
 
+void FunctionHeaderNode::setVariables(std::span<const std::string_view> newVariables) {
+    variables = newVariables;
+}
+
+std::size_t FunctionHeaderNode::getSlot(std::string_view variable) const {
+    for (std::size_t i = 0; i < variables.size(); ++i) {
+        if (variables[i] == variable) {
+            return i;
+        }
+    }
+
+    throw std::runtime_error("Variable not found: " + std::string(variable));
+}
+
+Context FunctionHeaderNode::bind(const Environment& env) const {
+    Context context;
+
+    for (std::size_t i = 0; i < variables.size(); ++i) {
+        auto it = env.find(std::string(variables[i]));
+        if (it == env.end()) {
+            throw std::runtime_error("Variable not found: " + std::string(variables[i]));
+        }
+        context[i] = it->second;
+    }
+
+    return context;
+}
+
 double FunctionHeaderNode::evaluateWithParameters(const std::vector<double>& args) const {
     if (args.size() != parameters.size()) {
         throw std::runtime_error("Invalid number of arguments");
     }
 
-    Environment env;
+    // Parameters occupy the first slots in declaration order
+    Context context;
     for (std::size_t i = 0; i < parameters.size(); ++i) {
-        env[parameters[i]] = args[i];
+        context[i] = args[i];
+    }
+
+    return body ? body->evaluate(context) : 0.0;
+}
+
+
+double InvokeNode::evaluate(const Context& context) const {
+    Context calleeContext;
+
+    for (std::size_t i = 0; i < arguments.size(); ++i) {
+        calleeContext[i] = arguments[i]->evaluate(context);
+    }
+
+    return callee->evaluate(calleeContext);
+}
+
+std::uint32_t InvokeNode::compile(Program& program) const {
+    std::array<std::uint32_t, Context::capacity> registers;
+
+    for (std::size_t i = 0; i < arguments.size(); ++i) {
+        registers[i] = arguments[i]->compile(program);
     }
 
-    return body ? body->evaluate(env) : 0.0;
+    return program.splice(*callee, std::span(registers).first(arguments.size()));
 }
 
+ASTNode* InvokeNode::substitute(Arena& arena, std::span<ASTNode* const> replacements) const {
+    std::array<ASTNode*, Context::capacity> copies;
 
-NegationNode::NegationNode(std::unique_ptr<ASTNode> node)
-    : m_node(std::move(node)) {}
+    for (std::size_t i = 0; i < arguments.size(); ++i) {
+        copies[i] = arguments[i]->substitute(arena, replacements);
+    }
+
+    // The callee is shared, only the call site is copied
+    return arena.make<InvokeNode>(header, callee, arena.copy<ASTNode*>(std::span(copies).first(arguments.size())));
+}
+
+std::string InvokeNode::toString() const {
+    std::string result = std::string(header->name) + "(";
+
+    // Free variables of the callee are passed implicitly
+    for (std::size_t i = 0; i < header->getParameterCount(); ++i) {
+        result += (i == 0 ? "" : ", ") + arguments[i]->toString();
+    }
+
+    return result + ")";
+}
+
+
+NegationNode::NegationNode(ASTNode* node)
+    : m_node(node) {}
 
-double NegationNode::evaluate(const Environment& env) const {
-    return -m_node->evaluate(env);
+double NegationNode::evaluate(const Context& context) const {
+    return -m_node->evaluate(context);
+}
+
+std::uint32_t NegationNode::compile(Program& program) const {
+    return program.emit(Program::OpCode::Negate, m_node->compile(program));
+}
+
+ASTNode* NegationNode::substitute(Arena& arena, std::span<ASTNode* const> arguments) const {
+    return arena.make<NegationNode>(m_node->substitute(arena, arguments));
 }
 
 std::string NegationNode::toString() const {
     return "-" + m_node->toString();
 }
+
+
+Expression::Expression(std::unique_ptr<Arena> arena, ASTNode* root)
+    : m_arena(std::move(arena)), m_root(root) {}
+
+Expression Expression::copy(const ASTNode& root, std::size_t arenaSize) {
+    auto arena = std::make_unique<Arena>(arenaSize);
+    ASTNode* copy = root.clone(*arena);
+
+    return Expression(std::move(arena), copy);
+}
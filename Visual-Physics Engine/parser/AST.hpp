@@ -13,28 +13,65 @@
 #include <numeric>
 #include <vector>
 #include <functional>
+#include <cstdint>
+#include <array>
+#include <type_traits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
 
+#include "Arena.hpp"
+#include "Builtins.hpp"
+
+class Program;
+
+// Named variables, only used at the API boundary (Function::setVariable, ParameterHUD)
 using Environment = std::unordered_map<std::string, float>;
 
+// Flat evaluation context, variables are resolved to slots at parse time
+struct Context {
+    static constexpr std::size_t capacity = 16;
+
+    std::array<double, capacity> slots{};
+
+    double& operator[](std::size_t slot) { return slots[slot]; }
+    double operator[](std::size_t slot) const { return slots[slot]; }
+};
+
+static_assert(std::is_trivially_copyable_v<Context>);
+
+// Nodes live in the Arena of their Expression, children are plain non-owning pointers
 struct ASTNode {
 
     virtual ~ASTNode() = default;
 
-    virtual double evaluate(const Environment& env) const = 0;
+    virtual double evaluate(const Context& context) const = 0;
+
+    // Appends the instructions of this node to the program and returns the result register
+    virtual std::uint32_t compile(Program& program) const = 0;
+
+    // Deep copy into the given arena, children are copied before their parent.
+    // The variable in slot i is replaced by a copy of arguments[i], without arguments the copy is exact
+    virtual ASTNode* substitute(Arena& arena, std::span<ASTNode* const> arguments) const = 0;
+
+    ASTNode* clone(Arena& arena) const { return substitute(arena, {}); }
 
     virtual std::string toString() const = 0;
 
 };
 
 struct BinaryOperationNode : public ASTNode {
-    std::unique_ptr<ASTNode> left;
-    std::unique_ptr<ASTNode> right;
+    ASTNode* left;
+    ASTNode* right;
     char operation; // e.g., '+', '-', '*', '/'
 
-    BinaryOperationNode(std::unique_ptr<ASTNode> left, std::unique_ptr<ASTNode> right, char operation)
-        : left(std::move(left)), right(std::move(right)), operation(operation) {}
+    BinaryOperationNode(ASTNode* left, ASTNode* right, char operation)
+        : left(left), right(right), operation(operation) {}
 
-    double evaluate(const Environment& env) const override;
+    double evaluate(const Context& context) const override;
+    std::uint32_t compile(Program& program) const override;
+    ASTNode* substitute(Arena& arena, std::span<ASTNode* const> arguments) const override;
 
     std::string toString() const override {
         return "(" + left->toString() + " " + operation + " " + right->toString() + ")";
@@ -42,15 +79,18 @@ struct BinaryOperationNode : public ASTNode {
 };
 
 struct VariableNode : public ASTNode {
-    std::string m_name;
+    std::string_view m_name; // Interned in the arena
+    std::size_t m_slot;
     bool m_negative = false;
 
-    VariableNode(const std::string& name, bool negative = false) : m_name(name), m_negative(negative) {}
+    VariableNode(std::string_view name, std::size_t slot, bool negative = false) : m_name(name), m_slot(slot), m_negative(negative) {}
 
-    double evaluate(const Environment& env) const override;
+    double evaluate(const Context& context) const override;
+    std::uint32_t compile(Program& program) const override;
+    ASTNode* substitute(Arena& arena, std::span<ASTNode* const> arguments) const override;
 
     std::string toString() const override {
-        return m_name;
+        return (m_negative ? "-" : "") + std::string(m_name);
     }
 };
 
@@ -59,7 +99,9 @@ struct ConstantNode : public ASTNode {
 
     ConstantNode(double value) : value(value) {}
 
-    double evaluate(const Environment& env) const override;
+    double evaluate(const Context& context) const override;
+    std::uint32_t compile(Program& program) const override;
+    ASTNode* substitute(Arena& arena, std::span<ASTNode* const> arguments) const override;
 
     std::string toString() const override {
         return std::to_string(value);
@@ -67,68 +109,182 @@ struct ConstantNode : public ASTNode {
 };
 
 struct FunctionNode : public ASTNode {
-    std::string functionName;
-    std::unique_ptr<ASTNode> argument;
-    
-    std::unordered_map<std::string, std::function<double(double)>> functionMap = {
-        {"sin", [](double x) { return std::sin(x); }},
-        {"cos", [](double x) { return std::cos(x); }},
-        {"tan", [](double x) { return std::tan(x); }},
-        {"sqrt", [](double x) {
-            if (x < 0) {
-                return 0.0;
-            }
-            return std::sqrt(x);
-        }},
-        {"exp", [](double x) { return std::exp(x); }},
-        {"log", [](double x) {
-            if (x <= 0) {
-                return 0.0;;
-            }
-            return std::log(x);
-        }},
-        {"abs", [](double x) { return std::abs(x); }}
-    };
-
-    FunctionNode(const std::string& function, std::unique_ptr<ASTNode> argument);
-
-    double evaluate(const Environment& env) const override;
+    Builtin function;
+    ASTNode* argument;
+
+    FunctionNode(Builtin function, ASTNode* argument);
+
+    double evaluate(const Context& context) const override;
+    std::uint32_t compile(Program& program) const override;
+    ASTNode* substitute(Arena& arena, std::span<ASTNode* const> arguments) const override;
 
     std::string toString() const override {
-        return functionName + "(" + argument->toString() + ")";
+        return std::string(builtinInfo(function).name) + "(" + argument->toString() + ")";
     }
 };
 
+enum class Condition : std::uint8_t {
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
+    Equal,
+    NotEqual,
+    And,
+    Or
+};
+
+// Comparison or logic operation, yields 1 or 0. Any value but 0 counts as true
+struct ConditionNode : public ASTNode {
+    ASTNode* left;
+    ASTNode* right;
+    Condition condition;
+
+    ConditionNode(ASTNode* left, ASTNode* right, Condition condition)
+        : left(left), right(right), condition(condition) {}
+
+    double evaluate(const Context& context) const override;
+    std::uint32_t compile(Program& program) const override;
+    ASTNode* substitute(Arena& arena, std::span<ASTNode* const> arguments) const override;
+
+    std::string toString() const override;
+
+    static std::optional<Condition> fromSymbol(std::string_view symbol);
+    static std::string_view symbol(Condition condition);
+};
+
+// Builtins with more than one argument, the arity is part of the type so evaluation has no loop
+template<std::size_t Arity>
+struct CallNode : public ASTNode {
+    Builtin function;
+    std::array<ASTNode*, Arity> arguments;
+
+    CallNode(Builtin function, std::array<ASTNode*, Arity> arguments)
+        : function(function), arguments(arguments) {}
+
+    double evaluate(const Context& context) const override;
+    std::uint32_t compile(Program& program) const override;
+    ASTNode* substitute(Arena& arena, std::span<ASTNode* const> arguments) const override;
+
+    std::string toString() const override;
+};
+
+using BinaryCallNode = CallNode<2>;
+using TernaryCallNode = CallNode<3>;
+
+// sum(k, first, last, term) and prod(...), the term is evaluated for every integer k from first to last.
+// The index has a slot of its own, which the series writes while iterating. Compiled into a loop,
+// so the bounds have to be constant by then
+struct SeriesNode : public ASTNode {
+    Builtin function; // Sum or Product
+    VariableNode* index;
+    ASTNode* first;
+    ASTNode* last;
+    ASTNode* term;
+
+    // Longer series are rejected instead of stalling the plot
+    static constexpr double maxTerms = 1 << 20;
+
+    SeriesNode(Builtin function, VariableNode* index, ASTNode* first, ASTNode* last, ASTNode* term)
+        : function(function), index(index), first(first), last(last), term(term) {}
+
+    double evaluate(const Context& context) const override;
+    std::uint32_t compile(Program& program) const override;
+    ASTNode* substitute(Arena& arena, std::span<ASTNode* const> arguments) const override;
+
+    std::string toString() const override;
+};
+
 struct FunctionHeaderNode : public ASTNode {
-    std::string name;
-    std::vector<std::string> parameters;
+    std::string_view name;
+    std::span<const std::string_view> parameters;
+
+    // Slot table, parameters first followed by free variables of the body
+    std::span<const std::string_view> variables;
 
-    std::unique_ptr<ASTNode> body;
+    ASTNode* body;
 
-    FunctionHeaderNode(const std::string& name, const std::vector<std::string>& parameters, std::unique_ptr<ASTNode> body = nullptr)
-        : name(name), parameters(parameters), body(std::move(body)) {}
+    FunctionHeaderNode(std::string_view name, std::span<const std::string_view> parameters, ASTNode* body = nullptr)
+        : name(name), parameters(parameters), variables(parameters), body(body) {}
 
-    double evaluate(const Environment& env) const override;
+    double evaluate(const Context& context) const override;
+    std::uint32_t compile(Program& program) const override;
+    ASTNode* substitute(Arena& arena, std::span<ASTNode* const> arguments) const override;
 
     std::string toString() const override;
 
-    void setBody(std::unique_ptr<ASTNode> newBody);
+    void setBody(ASTNode* newBody);
     std::size_t getParameterCount() const;
-    std::vector<std::string> getParameters() const { return parameters; }
+    std::vector<std::string> getParameters() const { return {parameters.begin(), parameters.end()}; }
+
+    // The names have to be interned in the arena of the node
+    void setVariables(std::span<const std::string_view> newVariables);
+    std::span<const std::string_view> getVariables() const { return variables; }
+    std::size_t getSlot(std::string_view variable) const;
+
+    Context bind(const Environment& env) const;
 
     double evaluateWithParameters(const std::vector<double>& args) const;
 };
 
 
+// Call of a scene function that is too large to inline, its program is spliced into the caller
+// when compiling. Both the header and the program belong to the callee's CompiledExpression,
+// which the caller keeps alive as a dependency
+struct InvokeNode : public ASTNode {
+    const FunctionHeaderNode* header;
+    const Program* callee;
+
+    // One per slot of the callee, its free variables are passed as variables of the caller
+    std::span<ASTNode*> arguments;
+
+    InvokeNode(const FunctionHeaderNode* header, const Program* callee, std::span<ASTNode*> arguments)
+        : header(header), callee(callee), arguments(arguments) {}
+
+    double evaluate(const Context& context) const override;
+    std::uint32_t compile(Program& program) const override;
+    ASTNode* substitute(Arena& arena, std::span<ASTNode* const> arguments) const override;
+
+    std::string toString() const override;
+};
+
+
 struct NegationNode : public ASTNode {
-    std::unique_ptr<ASTNode> m_node;
+    ASTNode* m_node;
 
-    NegationNode(std::unique_ptr<ASTNode> node);
+    NegationNode(ASTNode* node);
 
-    double evaluate(const Environment& env) const override;
+    double evaluate(const Context& context) const override;
+    std::uint32_t compile(Program& program) const override;
+    ASTNode* substitute(Arena& arena, std::span<ASTNode* const> arguments) const override;
         
     std::string toString() const override;
 
 };
 
+
+/// @class Expression
+/// @brief Owns a parsed tree together with the arena its nodes and names are allocated in.
+/// Moving an Expression keeps all node pointers valid, destroying it frees the whole tree at once.
+class Expression {
+public:
+    Expression() = default;
+    Expression(std::unique_ptr<Arena> arena, ASTNode* root);
+
+    // Copy of the tree packed into a fresh arena, nodes end up in evaluation order
+    static Expression copy(const ASTNode& root, std::size_t arenaSize = 1024);
+
+    ASTNode* get() const { return m_root; }
+    ASTNode& operator*() const { return *m_root; }
+    ASTNode* operator->() const { return m_root; }
+
+    explicit operator bool() const { return m_root != nullptr; }
+
+    Arena& getArena() { return *m_arena; }
+
+private:
+    std::unique_ptr<Arena> m_arena;
+    ASTNode* m_root = nullptr;
+};
+
 #endif // AST_HPP
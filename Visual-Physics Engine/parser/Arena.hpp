@@ -0,0 +1,85 @@
+//
+//  Arena.hpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+
+
+/// @class Arena
+/// @brief Monotonic memory for the nodes of one expression.
+/// Allocation is a pointer bump and everything is freed at once with the arena.
+/// Destructors of the objects are never run, so they must not own heap memory.
+class Arena {
+public:
+    explicit Arena(std::size_t initialSize = 1024) : m_resource(initialSize) {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    template<class T, class... Args>
+    T* make(Args&&... args) {
+        void* memory = m_resource.allocate(sizeof(T), alignof(T));
+        return new (memory) T(std::forward<Args>(args)...);
+    }
+
+    // Copy of the objects inside the arena, only for types without a destructor
+    template<class T>
+    std::span<T> copy(std::span<const T> objects) {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        auto* memory = static_cast<T*>(m_resource.allocate(sizeof(T) * objects.size(), alignof(T)));
+        std::uninitialized_copy(objects.begin(), objects.end(), memory);
+
+        return {memory, objects.size()};
+    }
+
+    // Copy of the text inside the arena, equal names share the same characters
+    std::string_view intern(std::string_view text) {
+        if (auto it = m_names.find(text); it != m_names.end()) {
+            return *it;
+        }
+
+        char* memory = static_cast<char*>(m_resource.allocate(text.size(), 1));
+        text.copy(memory, text.size());
+
+        return *m_names.emplace(memory, text.size()).first;
+    }
+
+    template<class Range>
+    std::span<const std::string_view> internAll(const Range& names) {
+        auto* memory = static_cast<std::string_view*>(m_resource.allocate(sizeof(std::string_view) * std::size(names), alignof(std::string_view)));
+
+        std::size_t count = 0;
+        for (const auto& name : names) {
+            new (memory + count++) std::string_view(intern(std::string_view(name)));
+        }
+
+        return {memory, count};
+    }
+
+    // Drops everything, the arena can be reused afterwards
+    void release() {
+        // The buckets of the name set live in the arena as well, so the set starts over empty
+        m_names = std::pmr::unordered_set<std::string_view>(&m_resource);
+        m_resource.release();
+    }
+
+private:
+    std::pmr::monotonic_buffer_resource m_resource;
+    std::pmr::unordered_set<std::string_view> m_names{&m_resource};
+};
+
+#endif // ARENA_HPP
@@ -0,0 +1,99 @@
+//
+//  Builtins.cpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#include "Builtins.hpp"
+
+#include <array>
+#include <cmath>
+
+#include "PerfectHash.hpp"
+
+
+namespace {
+    double builtinSin(double x) { return std::sin(x); }
+    double builtinCos(double x) { return std::cos(x); }
+    double builtinTan(double x) { return std::tan(x); }
+
+    double builtinSqrt(double x) {
+        if (x < 0) {
+            return 0.0;
+        }
+        return std::sqrt(x);
+    }
+
+    double builtinExp(double x) { return std::exp(x); }
+
+    double builtinLog(double x) {
+        if (x <= 0) {
+            return 0.0;
+        }
+        return std::log(x);
+    }
+
+    double builtinAbs(double x) { return std::abs(x); }
+
+    double builtinRoot(double x) { return std::sqrt(x); }
+
+    double builtinPow(double a, double b) { return std::pow(a, b); }
+
+    // Same operand order and nan behaviour as std::min and std::max
+    double builtinMin(double a, double b) { return b < a ? b : a; }
+    double builtinMax(double a, double b) { return a < b ? b : a; }
+
+    double builtinAtan2(double y, double x) { return std::atan2(y, x); }
+    double builtinHypot(double a, double b) { return std::hypot(a, b); }
+
+    double builtinClamp(double x, double low, double high) { return builtinMin(builtinMax(x, low), high); }
+
+    double builtinIf(double condition, double a, double b) { return condition != 0 ? a : b; }
+
+    constexpr std::array<BuiltinInfo, static_cast<std::size_t>(Builtin::Count)> builtins = {{
+        {"sin", 1, builtinSin},
+        {"cos", 1, builtinCos},
+        {"tan", 1, builtinTan},
+        {"sqrt", 1, builtinSqrt},
+        {"exp", 1, builtinExp},
+        {"log", 1, builtinLog},
+        {"abs", 1, builtinAbs},
+        {"root", 1, builtinRoot},
+        {"pow", 2, nullptr, builtinPow},
+        {"min", 2, nullptr, builtinMin},
+        {"max", 2, nullptr, builtinMax},
+        {"atan2", 2, nullptr, builtinAtan2},
+        {"hypot", 2, nullptr, builtinHypot},
+        {"clamp", 3, nullptr, nullptr, builtinClamp},
+        {"if", 3, nullptr, nullptr, builtinIf},
+        {"sum", 4},
+        {"prod", 4}
+    }};
+
+    // Root is only produced by the optimizer, its empty key keeps the name free and root(x) unknown.
+    // The name in the table is kept for printing
+    constexpr auto builtinNames = [] {
+        std::array<std::string_view, builtins.size()> names;
+
+        for (std::size_t i = 0; i < builtins.size(); ++i) {
+            names[i] = static_cast<Builtin>(i) == Builtin::Root ? std::string_view() : builtins[i].name;
+        }
+
+        return names;
+    }();
+
+    constexpr PerfectHash<builtins.size()> builtinHash(builtinNames);
+}
+
+const BuiltinInfo& builtinInfo(Builtin builtin) {
+    return builtins[static_cast<std::size_t>(builtin)];
+}
+
+std::optional<Builtin> findBuiltin(std::string_view name) {
+    if (auto index = builtinHash.find(name)) {
+        return static_cast<Builtin>(*index);
+    }
+
+    return std::nullopt;
+}
@@ -0,0 +1,57 @@
+//
+//  Builtins.hpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#ifndef BUILTINS_HPP
+#define BUILTINS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+
+// Built-in functions, resolved once at parse time
+enum class Builtin : std::uint8_t {
+    Sin,
+    Cos,
+    Tan,
+    Sqrt,
+    Exp,
+    Log,
+    Abs,
+    Root, // Unguarded square root, only produced by the optimizer for x^0.5 and not callable by name
+    Pow,
+    Min,
+    Max,
+    Atan2,
+    Hypot,
+    Clamp, // clamp(x, low, high)
+    If,    // if(condition, a, b), both branches are evaluated and one is selected
+    Sum,   // sum(k, first, last, term), the term for every integer k from first to last
+    Product,
+    Count
+};
+
+// Maximum number of arguments of a builtin
+constexpr std::size_t maxBuiltinArity = 4;
+
+struct BuiltinInfo {
+    std::string_view name;
+    std::uint8_t arity;
+
+    // Only the pointer matching the arity is set, none for the series which bind a variable
+    double (*function)(double) = nullptr;
+    double (*binary)(double, double) = nullptr;
+    double (*ternary)(double, double, double) = nullptr;
+};
+
+// Shared by all FunctionNodes, indexed by Builtin
+const BuiltinInfo& builtinInfo(Builtin builtin);
+
+std::optional<Builtin> findBuiltin(std::string_view name);
+
+#endif // BUILTINS_HPP
@@ -0,0 +1,418 @@
+//
+//  Differentiator.cpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#include "Differentiator.hpp"
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "Optimizer.hpp"
+
+
+FunctionHeaderNode* Differentiator::derive(const FunctionHeaderNode& header, std::string_view variable, Arena& arena) {
+
+    if (!header.body) {
+        throw std::runtime_error("Function " + std::string(header.name) + " has no expression to differentiate");
+    }
+
+    std::string name(header.name);
+    name += !header.parameters.empty() && header.parameters.front() == variable ? "'" : "_" + std::string(variable);
+
+    auto* derivative = arena.make<FunctionHeaderNode>(arena.intern(name), arena.internAll(header.parameters));
+    m_variables.assign(header.variables.begin(), header.variables.end());
+
+    // A variable the function does not use has the derivative 0
+    ASTNode* body = nullptr;
+
+    for (std::size_t slot = 0; slot < header.variables.size(); ++slot) {
+        if (header.variables[slot] == variable) {
+            body = differentiate(*header.body, slot, arena);
+        }
+    }
+
+    derivative->setVariables(arena.internAll(m_variables));
+    derivative->setBody(Optimizer().optimize(orZero(body, arena), arena));
+    return derivative;
+}
+
+ASTNode* Differentiator::differentiate(const ASTNode& node, std::size_t slot, Arena& arena) {
+
+    if (auto* header = dynamic_cast<const FunctionHeaderNode*>(&node)) {
+
+        return header->body ? differentiate(*header->body, slot, arena) : nullptr;
+
+    } else if (dynamic_cast<const ConstantNode*>(&node)) {
+
+        return nullptr;
+
+    } else if (auto* variable = dynamic_cast<const VariableNode*>(&node)) {
+
+        if (variable->m_slot != slot) {
+            return nullptr;
+        }
+        return arena.make<ConstantNode>(variable->m_negative ? -1.0 : 1.0);
+
+    } else if (auto* negation = dynamic_cast<const NegationNode*>(&node)) {
+
+        return negate(differentiate(*negation->m_node, slot, arena), arena);
+
+    } else if (auto* binary = dynamic_cast<const BinaryOperationNode*>(&node)) {
+
+        return differentiateBinary(*binary, slot, arena);
+
+    } else if (auto* function = dynamic_cast<const FunctionNode*>(&node)) {
+
+        return differentiateFunction(*function, slot, arena);
+
+    } else if (auto* call = dynamic_cast<const BinaryCallNode*>(&node)) {
+
+        return differentiateCall(*call, slot, arena);
+
+    } else if (auto* call = dynamic_cast<const TernaryCallNode*>(&node)) {
+
+        return differentiateCall(*call, slot, arena);
+
+    } else if (dynamic_cast<const ConditionNode*>(&node)) {
+
+        // Steps between 0 and 1, flat everywhere but at the step
+        return nullptr;
+
+    } else if (auto* series = dynamic_cast<const SeriesNode*>(&node)) {
+
+        return differentiateSeries(*series, slot, arena);
+
+    } else if (auto* invoke = dynamic_cast<const InvokeNode*>(&node)) {
+
+        return differentiateInvoke(*invoke, slot, arena);
+    }
+
+    throw std::runtime_error("Can not differentiate " + node.toString());
+}
+
+ASTNode* Differentiator::differentiateBinary(const BinaryOperationNode& binary, std::size_t slot, Arena& arena) {
+
+    const ASTNode& u = *binary.left;
+    const ASTNode& v = *binary.right;
+
+    switch (binary.operation) {
+        case '+':
+            return add(differentiate(u, slot, arena), differentiate(v, slot, arena), arena);
+
+        case '-':
+            return subtract(differentiate(u, slot, arena), differentiate(v, slot, arena), arena);
+
+        case '*':
+            // u'v + uv'
+            return add(multiply(differentiate(u, slot, arena), v.clone(arena), arena),
+                       multiply(u.clone(arena), differentiate(v, slot, arena), arena), arena);
+
+        case '/': {
+            // u'/v - uv'/v^2
+            ASTNode* du = differentiate(u, slot, arena);
+            ASTNode* dv = differentiate(v, slot, arena);
+
+            ASTNode* left = du ? arena.make<BinaryOperationNode>(du, v.clone(arena), '/') : nullptr;
+            ASTNode* right = nullptr;
+
+            if (dv) {
+                ASTNode* square = arena.make<BinaryOperationNode>(v.clone(arena), v.clone(arena), '*');
+                right = arena.make<BinaryOperationNode>(multiply(u.clone(arena), dv, arena), square, '/');
+            }
+            return subtract(left, right, arena);
+        }
+
+        case '^':
+            return differentiatePower(u, v, slot, arena);
+    }
+
+    throw std::runtime_error("Can not differentiate " + binary.toString());
+}
+
+ASTNode* Differentiator::differentiatePower(const ASTNode& base, const ASTNode& exponent, std::size_t slot, Arena& arena) {
+
+    ASTNode* du = differentiate(base, slot, arena);
+    ASTNode* dv = differentiate(exponent, slot, arena);
+
+    // Constant exponent, v * u^(v - 1) * u'
+    if (!dv) {
+        if (!du) {
+            return nullptr;
+        }
+
+        ASTNode* lowered = arena.make<BinaryOperationNode>(exponent.clone(arena), arena.make<ConstantNode>(1.0), '-');
+        ASTNode* power = arena.make<BinaryOperationNode>(base.clone(arena), lowered, '^');
+
+        return multiply(multiply(exponent.clone(arena), power, arena), du, arena);
+    }
+
+    // u^v * (v' ln(u) + v u'/u)
+    ASTNode* logarithm = arena.make<FunctionNode>(Builtin::Log, base.clone(arena));
+    ASTNode* inner = multiply(dv, logarithm, arena);
+
+    if (du) {
+        ASTNode* ratio = arena.make<BinaryOperationNode>(multiply(exponent.clone(arena), du, arena), base.clone(arena), '/');
+        inner = add(inner, ratio, arena);
+    }
+
+    ASTNode* power = arena.make<BinaryOperationNode>(base.clone(arena), exponent.clone(arena), '^');
+    return multiply(power, inner, arena);
+}
+
+ASTNode* Differentiator::differentiateFunction(const FunctionNode& function, std::size_t slot, Arena& arena) {
+
+    ASTNode* du = differentiate(*function.argument, slot, arena);
+
+    if (!du) {
+        return nullptr;
+    }
+
+    const ASTNode& u = *function.argument;
+    ASTNode* outer = nullptr;
+
+    switch (function.function) {
+        case Builtin::Sin:
+            outer = arena.make<FunctionNode>(Builtin::Cos, u.clone(arena));
+            break;
+        case Builtin::Cos:
+            outer = negate(arena.make<FunctionNode>(Builtin::Sin, u.clone(arena)), arena);
+            break;
+        case Builtin::Tan: {
+            // 1 + tan(u)^2, finite everywhere tan is
+            ASTNode* tangent = arena.make<FunctionNode>(Builtin::Tan, u.clone(arena));
+            ASTNode* square = arena.make<BinaryOperationNode>(tangent, tangent->clone(arena), '*');
+            outer = arena.make<BinaryOperationNode>(arena.make<ConstantNode>(1.0), square, '+');
+            break;
+        }
+        case Builtin::Sqrt:
+        case Builtin::Root: {
+            // 1 / (2 sqrt(u)), the guarded division makes it 0 where the guarded sqrt is 0
+            ASTNode* root = arena.make<FunctionNode>(function.function, u.clone(arena));
+            ASTNode* twice = arena.make<BinaryOperationNode>(arena.make<ConstantNode>(2.0), root, '*');
+            outer = arena.make<BinaryOperationNode>(arena.make<ConstantNode>(1.0), twice, '/');
+            break;
+        }
+        case Builtin::Exp:
+            outer = arena.make<FunctionNode>(Builtin::Exp, u.clone(arena));
+            break;
+        case Builtin::Log: {
+            // The guarded log is 0 for u <= 0, so is its derivative
+            ASTNode* positive = arena.make<ConditionNode>(u.clone(arena), arena.make<ConstantNode>(0.0), Condition::Greater);
+            ASTNode* reciprocal = arena.make<BinaryOperationNode>(arena.make<ConstantNode>(1.0), u.clone(arena), '/');
+            outer = arena.make<TernaryCallNode>(Builtin::If, std::array<ASTNode*, 3>{positive, reciprocal, arena.make<ConstantNode>(0.0)});
+            break;
+        }
+        case Builtin::Abs:
+            // Sign of u, the guarded division makes it 0 at u = 0
+            outer = arena.make<BinaryOperationNode>(u.clone(arena), arena.make<FunctionNode>(Builtin::Abs, u.clone(arena)), '/');
+            break;
+        default:
+            throw std::runtime_error("Can not differentiate " + function.toString());
+    }
+
+    return multiply(outer, du, arena);
+}
+
+ASTNode* Differentiator::differentiateCall(const BinaryCallNode& call, std::size_t slot, Arena& arena) {
+
+    const ASTNode& a = *call.arguments[0];
+    const ASTNode& b = *call.arguments[1];
+
+    switch (call.function) {
+        case Builtin::Pow:
+            return differentiatePower(a, b, slot, arena);
+
+        case Builtin::Min:
+        case Builtin::Max: {
+            // The derivative of the selected argument, ties go to the first one like in the evaluation
+            Condition condition = call.function == Builtin::Min ? Condition::LessEqual : Condition::GreaterEqual;
+            ASTNode* first = arena.make<ConditionNode>(a.clone(arena), b.clone(arena), condition);
+
+            return select(first, differentiate(a, slot, arena), differentiate(b, slot, arena), arena);
+        }
+
+        case Builtin::Atan2: {
+            // (x y' - y x') / (x^2 + y^2) for atan2(y, x)
+            ASTNode* numerator = subtract(multiply(b.clone(arena), differentiate(a, slot, arena), arena),
+                                          multiply(a.clone(arena), differentiate(b, slot, arena), arena), arena);
+            if (!numerator) {
+                return nullptr;
+            }
+
+            ASTNode* ySquare = arena.make<BinaryOperationNode>(a.clone(arena), a.clone(arena), '*');
+            ASTNode* xSquare = arena.make<BinaryOperationNode>(b.clone(arena), b.clone(arena), '*');
+
+            return arena.make<BinaryOperationNode>(numerator, arena.make<BinaryOperationNode>(xSquare, ySquare, '+'), '/');
+        }
+
+        case Builtin::Hypot: {
+            // (a a' + b b') / hypot(a, b)
+            ASTNode* numerator = add(multiply(a.clone(arena), differentiate(a, slot, arena), arena),
+                                     multiply(b.clone(arena), differentiate(b, slot, arena), arena), arena);
+            if (!numerator) {
+                return nullptr;
+            }
+
+            ASTNode* length = arena.make<BinaryCallNode>(Builtin::Hypot, std::array<ASTNode*, 2>{a.clone(arena), b.clone(arena)});
+            return arena.make<BinaryOperationNode>(numerator, length, '/');
+        }
+
+        default:
+            break;
+    }
+
+    throw std::runtime_error("Can not differentiate " + call.toString());
+}
+
+ASTNode* Differentiator::differentiateCall(const TernaryCallNode& call, std::size_t slot, Arena& arena) {
+
+    switch (call.function) {
+        case Builtin::If:
+            return select(call.arguments[0]->clone(arena),
+                          differentiate(*call.arguments[1], slot, arena),
+                          differentiate(*call.arguments[2], slot, arena), arena);
+
+        case Builtin::Clamp: {
+            // clamp(x, low, high) is min(max(x, low), high), differentiated in that form
+            auto* lower = arena.make<BinaryCallNode>(Builtin::Max, std::array<ASTNode*, 2>{call.arguments[0]->clone(arena), call.arguments[1]->clone(arena)});
+            auto* upper = arena.make<BinaryCallNode>(Builtin::Min, std::array<ASTNode*, 2>{lower, call.arguments[2]->clone(arena)});
+
+            return differentiateCall(*upper, slot, arena);
+        }
+
+        default:
+            break;
+    }
+
+    throw std::runtime_error("Can not differentiate " + call.toString());
+}
+
+ASTNode* Differentiator::differentiateSeries(const SeriesNode& series, std::size_t slot, Arena& arena) {
+
+    // The bounds are constant when compiled, only the terms change
+    ASTNode* term = differentiate(*series.term, slot, arena);
+
+    if (!term) {
+        return nullptr;
+    }
+
+    auto* index = static_cast<VariableNode*>(series.index->clone(arena));
+
+    if (series.function == Builtin::Sum) {
+        return arena.make<SeriesNode>(Builtin::Sum, index, series.first->clone(arena), series.last->clone(arena), term);
+    }
+
+    // Product rule, the sum over k of t'(k) times the product of t(j) over every j != k.
+    // The inner product runs over a fresh index j, its term is t with k replaced by j
+    VariableNode* other = freshIndex(series.index->m_name, arena);
+
+    std::vector<ASTNode*> arguments(series.index->m_slot + 1);
+
+    for (std::size_t i = 0; i < arguments.size(); ++i) {
+        arguments[i] = arena.make<VariableNode>(m_variables[i], i);
+    }
+    arguments[series.index->m_slot] = other;
+
+    ASTNode* same = arena.make<ConditionNode>(other->clone(arena), index->clone(arena), Condition::Equal);
+    ASTNode* factor = arena.make<TernaryCallNode>(Builtin::If, std::array<ASTNode*, 3>{same, arena.make<ConstantNode>(1.0), series.term->substitute(arena, arguments)});
+    ASTNode* others = arena.make<SeriesNode>(Builtin::Product, other, series.first->clone(arena), series.last->clone(arena), factor);
+
+    return arena.make<SeriesNode>(Builtin::Sum, index, series.first->clone(arena), series.last->clone(arena), multiply(term, others, arena));
+}
+
+ASTNode* Differentiator::differentiateInvoke(const InvokeNode& invoke, std::size_t slot, Arena& arena) {
+
+    if (!invoke.header->body) {
+        throw std::runtime_error("Function " + std::string(invoke.header->name) + " has no expression to differentiate");
+    }
+
+    // Chain rule over every slot of the callee, the partial derivatives are inlined with the arguments
+    ASTNode* derivative = nullptr;
+
+    for (std::size_t i = 0; i < invoke.arguments.size(); ++i) {
+
+        ASTNode* inner = differentiate(*invoke.arguments[i], slot, arena);
+
+        if (!inner) {
+            continue;
+        }
+
+        // The body is differentiated in the slot table of the callee. Fresh indices it needs
+        // are appended there and moved to new slots of the caller with the arguments
+        std::vector<std::string_view> caller = std::exchange(m_variables, {invoke.header->variables.begin(), invoke.header->variables.end()});
+        ASTNode* partial = differentiate(*invoke.header->body, i, arena);
+        std::vector<std::string_view> callee = std::exchange(m_variables, std::move(caller));
+
+        if (partial) {
+            std::vector<ASTNode*> arguments(invoke.arguments.begin(), invoke.arguments.end());
+
+            for (std::size_t slot = arguments.size(); slot < callee.size(); ++slot) {
+                arguments.push_back(freshIndex(callee[slot], arena));
+            }
+
+            derivative = add(derivative, multiply(partial->substitute(arena, arguments), inner, arena), arena);
+        }
+    }
+
+    return derivative;
+}
+
+ASTNode* Differentiator::add(ASTNode* lhs, ASTNode* rhs, Arena& arena) {
+    if (!lhs) {
+        return rhs;
+    }
+    if (!rhs) {
+        return lhs;
+    }
+    return arena.make<BinaryOperationNode>(lhs, rhs, '+');
+}
+
+ASTNode* Differentiator::subtract(ASTNode* lhs, ASTNode* rhs, Arena& arena) {
+    if (!rhs) {
+        return lhs;
+    }
+    if (!lhs) {
+        return negate(rhs, arena);
+    }
+    return arena.make<BinaryOperationNode>(lhs, rhs, '-');
+}
+
+ASTNode* Differentiator::multiply(ASTNode* lhs, ASTNode* rhs, Arena& arena) {
+    if (!lhs || !rhs) {
+        return nullptr;
+    }
+    return arena.make<BinaryOperationNode>(lhs, rhs, '*');
+}
+
+ASTNode* Differentiator::negate(ASTNode* node, Arena& arena) {
+    return node ? arena.make<NegationNode>(node) : nullptr;
+}
+
+ASTNode* Differentiator::select(ASTNode* condition, ASTNode* a, ASTNode* b, Arena& arena) {
+    if (!a && !b) {
+        return nullptr;
+    }
+    return arena.make<TernaryCallNode>(Builtin::If, std::array<ASTNode*, 3>{condition, orZero(a, arena), orZero(b, arena)});
+}
+
+ASTNode* Differentiator::orZero(ASTNode* node, Arena& arena) {
+    return node ? node : arena.make<ConstantNode>(0.0);
+}
+
+VariableNode* Differentiator::freshIndex(std::string_view name, Arena& arena) {
+
+    if (m_variables.size() >= Context::capacity) {
+        throw std::runtime_error("Too many variables to differentiate a product");
+    }
+
+    std::size_t slot = m_variables.size();
+    std::string indexName = std::string(name.substr(0, name.find('#'))) + "#" + std::to_string(slot);
+
+    m_variables.push_back(arena.intern(indexName));
+
+    return arena.make<VariableNode>(m_variables.back(), slot);
+}
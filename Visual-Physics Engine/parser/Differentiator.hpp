@@ -0,0 +1,65 @@
+//
+//  Differentiator.hpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#ifndef DIFFERENTIATOR_HPP
+#define DIFFERENTIATOR_HPP
+
+#include <string_view>
+#include <vector>
+
+#include "AST.hpp"
+
+
+/// @class Differentiator
+/// @brief Symbolic derivative of a parsed tree with respect to one of its variables.
+/// The derivative is a new tree that shares no nodes with the original, terms that are
+/// identically 0 are dropped while building it and the rest is simplified by the Optimizer.
+/// Comparisons are piecewise constant and differentiate to 0, if() and min/max differentiate
+/// their selected branch. The derivative of prod() needs a second index, which gets a new slot
+/// at the end of the slot table of the derivative.
+class Differentiator {
+public:
+    Differentiator() = default;
+
+    // Header of the derivative with the same parameters and slots, named f' for the first parameter
+    // and f_a for any other variable a. Throws if the header has no body, e.g. a static expression
+    FunctionHeaderNode* derive(const FunctionHeaderNode& header, std::string_view variable, Arena& arena);
+
+private:
+    // nullptr stands for a derivative that is identically 0
+    ASTNode* differentiate(const ASTNode& node, std::size_t slot, Arena& arena);
+
+    ASTNode* differentiateBinary(const BinaryOperationNode& binary, std::size_t slot, Arena& arena);
+    ASTNode* differentiateFunction(const FunctionNode& function, std::size_t slot, Arena& arena);
+    ASTNode* differentiateCall(const BinaryCallNode& call, std::size_t slot, Arena& arena);
+    ASTNode* differentiateCall(const TernaryCallNode& call, std::size_t slot, Arena& arena);
+    ASTNode* differentiateSeries(const SeriesNode& series, std::size_t slot, Arena& arena);
+    ASTNode* differentiateInvoke(const InvokeNode& invoke, std::size_t slot, Arena& arena);
+
+    // d(base^exponent), shared by ^ and pow()
+    ASTNode* differentiatePower(const ASTNode& base, const ASTNode& exponent, std::size_t slot, Arena& arena);
+
+    // Builders that treat nullptr as 0
+    static ASTNode* add(ASTNode* lhs, ASTNode* rhs, Arena& arena);
+    static ASTNode* subtract(ASTNode* lhs, ASTNode* rhs, Arena& arena);
+    static ASTNode* multiply(ASTNode* lhs, ASTNode* rhs, Arena& arena);
+    static ASTNode* negate(ASTNode* node, Arena& arena);
+
+    // if(condition, a, b) of two derivatives, 0 if both are
+    static ASTNode* select(ASTNode* condition, ASTNode* a, ASTNode* b, Arena& arena);
+
+    static ASTNode* orZero(ASTNode* node, Arena& arena);
+
+    // Index variable in a new slot, named like the indices of the parser
+    VariableNode* freshIndex(std::string_view name, Arena& arena);
+
+private:
+    // Slot table of the tree that is differentiated, grows by the fresh indices
+    std::vector<std::string_view> m_variables;
+};
+
+#endif // DIFFERENTIATOR_HPP
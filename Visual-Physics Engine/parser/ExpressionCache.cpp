@@ -0,0 +1,312 @@
+//
+//  ExpressionCache.cpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#include "ExpressionCache.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <stdexcept>
+
+#include "Parser.hpp"
+#include "Differentiator.hpp"
+#include "../core/ThreadManager.hpp"
+
+
+namespace {
+
+    bool isWordCharacter(char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.';
+    }
+
+    // Whether the text followed by c tokenizes differently once the whitespace between them is gone
+    bool fuses(std::string_view text, char c) {
+
+        char last = text.back();
+
+        // "a b" must not turn into the identifier "ab"
+        if (isWordCharacter(last) && isWordCharacter(c)) {
+            return true;
+        }
+
+        // "< =" must not turn into "<=", the same pairs as in Tokenizer::scanDelimiter
+        if (std::string_view("=<>!&|").find(last) != std::string_view::npos &&
+            ((c == '=' && last != '&' && last != '|') || ((last == '&' || last == '|') && c == last))) {
+            return true;
+        }
+
+        // "1e -5" and "1e- 5" are 1 * e - 5, without the whitespace they are one number
+        bool exponent = last == 'e' || last == 'E';
+        bool sign = (last == '+' || last == '-') && text.size() >= 2 && (text[text.size() - 2] == 'e' || text[text.size() - 2] == 'E');
+
+        return (exponent && (c == '+' || c == '-')) || (sign && std::isdigit(static_cast<unsigned char>(c)));
+    }
+
+    // Nothing is persisted if the user has no private cache directory
+    std::unique_ptr<ExpressionStore> defaultStore() {
+        std::filesystem::path file = ExpressionStore::defaultFile();
+
+        return file.empty() ? nullptr : std::make_unique<ExpressionStore>(std::move(file));
+    }
+}
+
+
+ExpressionCache& ExpressionCache::instance() {
+    static ExpressionCache cache(defaultCapacity, defaultStore());
+    return cache;
+}
+
+ExpressionCache::ExpressionCache(std::size_t capacity, std::unique_ptr<ExpressionStore> store)
+    : m_capacity(capacity), m_store(std::move(store)) {
+}
+
+std::shared_ptr<const CompiledExpression> ExpressionCache::get(std::string_view source) {
+
+    std::string key = normalize(source);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (auto it = m_index.find(key); it != m_index.end()) {
+            m_hits++;
+
+            m_entries.splice(m_entries.begin(), m_entries, it->second);
+            return it->second->expression;
+        }
+
+        m_misses++;
+    }
+
+    // Two threads missing the same key both build it, the first one to finish is kept
+    auto expression = build(source, key);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (auto it = m_index.find(key); it != m_index.end()) {
+        return it->second->expression;
+    }
+
+    if (m_capacity == 0) {
+        return expression;
+    }
+
+    m_entries.push_front({std::move(key), expression});
+    m_index.emplace(m_entries.front().key, m_entries.begin());
+
+    evict();
+
+    return expression;
+}
+
+std::vector<ExpressionCache::Result> ExpressionCache::getAll(std::span<const std::string> sources, ThreadManager& threadManager) {
+
+    // Shared with the tasks, a task that only starts after the batch is done finds no work left
+    struct Batch {
+        std::span<const std::string> sources;
+        std::vector<Result> results;
+
+        std::atomic<std::size_t> next{0};
+        std::atomic<std::size_t> done{0};
+    };
+
+    auto batch = std::make_shared<Batch>();
+    batch->sources = sources;
+    batch->results.resize(sources.size());
+
+    auto work = [this, batch] {
+
+        std::size_t count = batch->sources.size();
+
+        for (std::size_t i = batch->next++; i < count; i = batch->next++) {
+
+            try {
+                batch->results[i] = get(batch->sources[i]);
+            } catch (const std::exception& e) {
+                batch->results[i] = std::unexpected(std::string(e.what()));
+            }
+
+            if (++batch->done == count) {
+                batch->done.notify_all();
+            }
+        }
+    };
+
+    // Items are claimed one at a time, one parse is long enough to amortize the atomic
+    std::size_t workers = std::min(threadManager.getThreadCount(), sources.size() / 2);
+
+    for (std::size_t i = 0; i < workers; ++i) {
+        threadManager.enqueue(work);
+    }
+
+    work();
+
+    for (std::size_t done = batch->done; done < sources.size(); done = batch->done) {
+        batch->done.wait(done);
+    }
+
+    return std::move(batch->results);
+}
+
+std::string ExpressionCache::normalize(std::string_view source) {
+
+    std::string normalized;
+    normalized.reserve(source.size());
+
+    bool space = false;
+
+    for (char c : source) {
+
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            space = true;
+            continue;
+        }
+
+        if (space && !normalized.empty() && fuses(normalized, c)) {
+            normalized += ' ';
+        }
+
+        normalized += c;
+        space = false;
+    }
+
+    return normalized;
+}
+
+ExpressionCache::Statistics ExpressionCache::getStatistics() const {
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return {m_hits, m_misses, m_loads, m_evictions, m_entries.size(), m_capacity};
+}
+
+void ExpressionCache::setCapacity(std::size_t capacity) {
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_capacity = capacity;
+    evict();
+}
+
+void ExpressionCache::clear() {
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Functions still holding an expression keep it alive
+    m_index.clear();
+    m_entries.clear();
+}
+
+std::shared_ptr<CompiledExpression> CompiledExpression::parse(std::string_view source, Parser& parser) {
+
+    parser.setExpression(std::string(source));
+
+    auto expression = std::make_shared<CompiledExpression>();
+    expression->source = source;
+    expression->ast = parser.parse();
+    expression->header = dynamic_cast<const FunctionHeaderNode*>(expression->ast.get());
+
+    if (!expression->header) {
+        throw std::runtime_error("Not a function definition: " + expression->source);
+    }
+
+    expression->program.compile(*expression->header);
+    expression->dependencies = parser.getDependencies();
+
+    return expression;
+}
+
+const FunctionHeaderNode* CompiledExpression::tree() const {
+
+    if (header->body || !lazyTree) {
+        return header->body ? header : nullptr;
+    }
+
+    // A parse error leaves the flag unset, the next call throws it again
+    std::call_once(m_parseOnce, [this] {
+
+        Parser parser;
+        parser.setExpression(source);
+
+        Expression parsed = parser.parse();
+
+        // Callers index the tree with the slots of the program
+        auto* tree = dynamic_cast<const FunctionHeaderNode*>(parsed.get());
+
+        if (!tree || !std::ranges::equal(tree->variables, header->variables)) {
+            throw std::runtime_error("Tree of " + std::string(header->name) + " does not match its slot table");
+        }
+
+        m_parsed = std::move(parsed);
+    });
+
+    return dynamic_cast<const FunctionHeaderNode*>(m_parsed.get());
+}
+
+std::shared_ptr<CompiledExpression> CompiledExpression::derive(std::shared_ptr<const CompiledExpression> function, std::string_view variable) {
+
+    const FunctionHeaderNode* tree = function->tree();
+
+    if (!tree) {
+        throw std::runtime_error("Function " + std::string(function->header->name) + " has no expression to differentiate");
+    }
+
+    auto arena = std::make_unique<Arena>();
+    FunctionHeaderNode* header = Differentiator().derive(*tree, variable, *arena);
+
+    auto expression = std::make_shared<CompiledExpression>();
+
+    // Only for display, the tree is not parsed from it
+    std::string parameters;
+    for (std::string_view parameter : header->parameters) {
+        parameters += (parameters.empty() ? "" : ", ") + std::string(parameter);
+    }
+    expression->source = std::string(header->name) + "(" + parameters + ") = " + header->body->toString();
+
+    expression->ast = Expression(std::move(arena), header);
+    expression->header = header;
+    expression->program.compile(*header);
+    expression->dependencies = {std::move(function)};
+    expression->derivative = variable;
+
+    return expression;
+}
+
+std::shared_ptr<const CompiledExpression> ExpressionCache::build(std::string_view source, const std::string& key) {
+
+    if (m_store) {
+        if (auto expression = m_store->load(key)) {
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_loads++;
+
+            return expression;
+        }
+    }
+
+    // The scratch arena and token buffer of the parser are reused by every miss on this thread
+    thread_local Parser parser;
+
+    // The original text is parsed so error offsets match what the user typed
+    auto expression = CompiledExpression::parse(source, parser);
+
+    if (m_store) {
+        m_store->store(key, *expression);
+    }
+
+    return expression;
+}
+
+void ExpressionCache::evict() {
+
+    while (m_entries.size() > m_capacity) {
+
+        m_index.erase(m_entries.back().key);
+        m_entries.pop_back();
+
+        m_evictions++;
+    }
+}
@@ -0,0 +1,144 @@
+//
+//  ExpressionCache.hpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#ifndef EXPRESSION_CACHE_HPP
+#define EXPRESSION_CACHE_HPP
+
+#include <cstddef>
+#include <expected>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "AST.hpp"
+#include "Program.hpp"
+#include "ExpressionStore.hpp"
+
+
+class Parser;
+class ThreadManager;
+
+/// @brief Parsed, optimized and compiled form of one expression.
+/// Never modified after it was built, so any number of functions and threads can share it.
+struct CompiledExpression {
+    std::string source; // Text of the first parse, functions sharing the entry may differ in whitespace
+    Expression ast;
+    const FunctionHeaderNode* header = nullptr;
+    Program program;
+
+    // User functions the source calls, in the version it was compiled against. The tree may point
+    // into them. Only parsers with user functions in their symbol table produce dependencies
+    std::vector<std::shared_ptr<const CompiledExpression>> dependencies;
+
+    // Variable a derivative was taken for, empty for parsed expressions. A derivative has no source
+    // that parses, it is derived again from its only dependency when that changes
+    std::string derivative;
+
+    // Built without a tree, its source parses to it with the builtins alone. Set for expressions
+    // loaded from the ExpressionStore and for static expressions
+    bool lazyTree = false;
+
+    // Header with a body, nullptr if there is none. An expression with a lazy tree parses its source
+    // on the first call and keeps the tree for as long as it lives, parse errors are thrown
+    const FunctionHeaderNode* tree() const;
+
+    // Parses and compiles the source with the symbols of the given parser, parse errors are thrown
+    static std::shared_ptr<CompiledExpression> parse(std::string_view source, Parser& parser);
+
+    // Simplified derivative of the function with respect to one of its variables, depends on the function.
+    // Throws if the function has no tree
+    static std::shared_ptr<CompiledExpression> derive(std::shared_ptr<const CompiledExpression> function, std::string_view variable);
+
+private:
+    mutable std::once_flag m_parseOnce;
+    mutable Expression m_parsed;
+};
+
+
+/// @class ExpressionCache
+/// @brief Process wide LRU cache from normalized source text to its compiled expression.
+/// Sources that only differ in whitespace share one entry. Parsing happens outside of the
+/// lock, so a miss never blocks lookups of other threads. Misses are looked up in the
+/// ExpressionStore before they are parsed. Only sources parsed with the default symbol
+/// table are cached.
+class ExpressionCache {
+public:
+    struct Statistics {
+        std::size_t hits = 0;
+        std::size_t misses = 0;
+        std::size_t loads = 0; // Misses served by the store without parsing
+        std::size_t evictions = 0;
+        std::size_t size = 0;
+        std::size_t capacity = 0;
+    };
+
+    // The compiled expression or the message of the parse error
+    using Result = std::expected<std::shared_ptr<const CompiledExpression>, std::string>;
+
+    static constexpr std::size_t defaultCapacity = 1024;
+
+public:
+    // Backed by the store in ExpressionStore::defaultFile() if there is one
+    static ExpressionCache& instance();
+
+    // Without a store nothing is persisted between runs
+    explicit ExpressionCache(std::size_t capacity = defaultCapacity, std::unique_ptr<ExpressionStore> store = nullptr);
+
+    ExpressionCache(const ExpressionCache&) = delete;
+    ExpressionCache& operator=(const ExpressionCache&) = delete;
+
+    // Loads the source from the store or parses and compiles it on a miss,
+    // parse errors are thrown and not cached
+    std::shared_ptr<const CompiledExpression> get(std::string_view source);
+
+    // Compiles all sources in parallel on the workers, results are in the order of the sources.
+    // The calling thread works on the batch as well, so this may also be called from a worker
+    std::vector<Result> getAll(std::span<const std::string> sources, ThreadManager& threadManager);
+
+    // Whitespace is dropped unless removing it changes the tokens, e.g. between two names, in "< =" or in "1e -5"
+    static std::string normalize(std::string_view source);
+
+    Statistics getStatistics() const;
+
+    // Shrinking evicts the least recently used entries right away
+    void setCapacity(std::size_t capacity);
+    void clear();
+
+private:
+    std::shared_ptr<const CompiledExpression> build(std::string_view source, const std::string& key);
+
+    void evict();
+
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<const CompiledExpression> expression;
+    };
+
+    mutable std::mutex m_mutex;
+
+    // Most recently used entry at the front, the keys of the map view the strings in the list
+    std::list<Entry> m_entries;
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> m_index;
+
+    std::size_t m_capacity;
+
+    // Second level on disk, thread safe by itself
+    std::unique_ptr<ExpressionStore> m_store;
+
+    std::size_t m_hits = 0;
+    std::size_t m_misses = 0;
+    std::size_t m_loads = 0;
+    std::size_t m_evictions = 0;
+};
+
+#endif // EXPRESSION_CACHE_HPP
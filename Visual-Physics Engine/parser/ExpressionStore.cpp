@@ -0,0 +1,372 @@
+//
+//  ExpressionStore.cpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#include "ExpressionStore.hpp"
+
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "ExpressionCache.hpp"
+#include "NativeCompiler.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #define EXPRESSION_STORE_MMAP 1
+#else
+    #define EXPRESSION_STORE_MMAP 0
+#endif
+
+
+namespace {
+
+    constexpr char magic[4] = {'V', 'P', 'E', 'X'};
+    constexpr std::uint32_t byteOrderMark = 0x01020304;
+
+    constexpr std::size_t headerSize = sizeof(magic) + 2 * sizeof(std::uint32_t);
+    constexpr std::size_t instructionSize = sizeof(std::uint8_t) + 3 * sizeof(std::uint32_t) + sizeof(double);
+
+
+    // Bounds checked reader over the mapping, every read past the end throws
+    class Reader {
+    public:
+        Reader(const std::byte* data, std::size_t size, std::size_t offset = 0)
+            : m_data(data), m_size(size), m_offset(offset) {}
+
+        template<class T>
+        T read() {
+            T value;
+            std::memcpy(&value, take(sizeof(T)), sizeof(T));
+            return value;
+        }
+
+        std::string_view string() {
+            auto length = read<std::uint32_t>();
+            return {reinterpret_cast<const char*>(take(length)), length};
+        }
+
+        std::size_t offset() const { return m_offset; }
+        std::size_t remaining() const { return m_size - m_offset; }
+
+    private:
+        const std::byte* take(std::size_t count) {
+            if (count > m_size - m_offset) {
+                throw std::runtime_error("Truncated expression store entry");
+            }
+
+            const std::byte* data = m_data + m_offset;
+            m_offset += count;
+
+            return data;
+        }
+
+    private:
+        const std::byte* m_data;
+        std::size_t m_size;
+        std::size_t m_offset;
+    };
+
+
+    class Writer {
+    public:
+        template<class T>
+        void write(T value) {
+            m_buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        void string(std::string_view text) {
+            write(static_cast<std::uint32_t>(text.size()));
+            m_buffer.append(text);
+        }
+
+        std::string& buffer() { return m_buffer; }
+
+    private:
+        std::string m_buffer;
+    };
+}
+
+
+ExpressionStore::ExpressionStore(std::filesystem::path file)
+    : m_file(std::move(file)) {
+
+    map();
+    index();
+}
+
+ExpressionStore::~ExpressionStore() {
+    unmap();
+}
+
+std::filesystem::path ExpressionStore::defaultFile() {
+    std::filesystem::path directory = NativeCompiler::userCacheDirectory();
+
+    return directory.empty() ? directory : directory / "expressions.bin";
+}
+
+void ExpressionStore::map() {
+#if EXPRESSION_STORE_MMAP
+    int descriptor = ::open(m_file.c_str(), O_RDONLY | O_NOFOLLOW);
+
+    if (descriptor < 0) {
+        return;
+    }
+
+    struct stat status;
+
+    // A file somebody else could have written is not read, the index starts a new one
+    bool trusted = ::fstat(descriptor, &status) == 0 && status.st_uid == ::getuid() &&
+                   (status.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+
+    if (trusted && status.st_size > 0) {
+
+        void* data = ::mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+        if (data != MAP_FAILED) {
+            m_data = static_cast<const std::byte*>(data);
+            m_size = static_cast<std::size_t>(status.st_size);
+        }
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    ::close(descriptor);
+#else
+    std::ifstream stream(m_file, std::ios::binary | std::ios::ate);
+
+    if (!stream) {
+        return;
+    }
+
+    m_size = static_cast<std::size_t>(stream.tellg());
+
+    auto* data = new std::byte[m_size];
+    stream.seekg(0);
+    stream.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(m_size));
+
+    m_data = data;
+#endif
+}
+
+void ExpressionStore::unmap() {
+    if (!m_data) {
+        return;
+    }
+
+#if EXPRESSION_STORE_MMAP
+    ::munmap(const_cast<std::byte*>(m_data), m_size);
+#else
+    delete[] m_data;
+#endif
+
+    m_data = nullptr;
+    m_size = 0;
+}
+
+void ExpressionStore::index() {
+
+    if (m_size >= headerSize) {
+
+        Reader reader(m_data, m_size);
+
+        auto fileMagic = reader.read<std::array<char, 4>>();
+
+        m_valid = std::memcmp(fileMagic.data(), magic, sizeof(magic)) == 0 &&
+                  reader.read<std::uint32_t>() == formatVersion &&
+                  reader.read<std::uint32_t>() == byteOrderMark;
+    }
+
+    if (!m_valid) {
+
+        // Written by another version, the next store starts a new file
+        unmap();
+
+        std::error_code error;
+        std::filesystem::remove(m_file, error);
+
+        return;
+    }
+
+    // Only the entry headers are read here, a truncated last entry ends the index
+    Reader reader(m_data, m_size, headerSize);
+    std::size_t end = headerSize;
+
+    try {
+        while (reader.offset() < m_size) {
+
+            auto size = reader.read<std::uint32_t>();
+            std::size_t payload = reader.offset();
+
+            if (size < sizeof(std::uint64_t) || size > m_size - payload) {
+                break;
+            }
+
+            m_index.try_emplace(reader.read<std::uint64_t>(), payload);
+
+            end = payload + size;
+            reader = Reader(m_data, m_size, end);
+        }
+    } catch (const std::runtime_error&) {
+    }
+
+    if (end < m_size) {
+        m_end = end;
+    }
+}
+
+std::shared_ptr<const CompiledExpression> ExpressionStore::load(std::string_view source) const {
+
+    auto it = m_index.find(NativeCompiler::hash(source));
+
+    if (it == m_index.end()) {
+        return nullptr;
+    }
+
+    try {
+        return decode(source, it->second);
+    } catch (const std::runtime_error&) {
+        return nullptr;
+    }
+}
+
+std::shared_ptr<const CompiledExpression> ExpressionStore::decode(std::string_view source, std::size_t offset) const {
+
+    Reader reader(m_data, m_size, offset);
+    reader.read<std::uint64_t>();
+
+    // Equal hashes of different sources are treated as a miss
+    if (reader.string() != source) {
+        return nullptr;
+    }
+
+    auto expression = std::make_shared<CompiledExpression>();
+    expression->source = source;
+
+    auto arena = std::make_unique<Arena>();
+
+    std::string_view name = arena->intern(reader.string());
+
+    auto parameterCount = reader.read<std::uint32_t>();
+    auto variableCount = reader.read<std::uint32_t>();
+
+    if (parameterCount > variableCount || variableCount > Context::capacity) {
+        throw std::runtime_error("Invalid slot table in expression store");
+    }
+
+    std::vector<std::string_view> variables(variableCount);
+
+    for (auto& variable : variables) {
+        variable = reader.string();
+    }
+
+    std::span<const std::string_view> slots = arena->internAll(variables);
+
+    auto* header = arena->make<FunctionHeaderNode>(name, slots.first(parameterCount));
+    header->setVariables(slots);
+
+    auto instructionCount = reader.read<std::uint32_t>();
+
+    if (instructionCount > reader.remaining() / instructionSize) {
+        throw std::runtime_error("Truncated expression store entry");
+    }
+
+    std::vector<Program::Instruction> instructions(instructionCount);
+
+    for (auto& instruction : instructions) {
+        instruction.op = static_cast<Program::OpCode>(reader.read<std::uint8_t>());
+        instruction.a = reader.read<std::uint32_t>();
+        instruction.b = reader.read<std::uint32_t>();
+        instruction.c = reader.read<std::uint32_t>();
+        instruction.value = reader.read<double>();
+    }
+
+    expression->program.load(std::move(instructions));
+
+    expression->ast = Expression(std::move(arena), header);
+    expression->header = header;
+    expression->lazyTree = true;
+
+    return expression;
+}
+
+void ExpressionStore::store(std::string_view source, const CompiledExpression& expression) {
+
+    // Calls of user functions are not determined by the source alone
+    if (!expression.dependencies.empty()) {
+        return;
+    }
+
+    std::uint64_t key = NativeCompiler::hash(source);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_index.contains(key) || !m_written.insert(key).second) {
+        return;
+    }
+
+    const FunctionHeaderNode& header = *expression.header;
+
+    Writer payload;
+    payload.write(key);
+    payload.string(source);
+    payload.string(header.name);
+    payload.write(static_cast<std::uint32_t>(header.parameters.size()));
+    payload.write(static_cast<std::uint32_t>(header.variables.size()));
+
+    for (std::string_view variable : header.variables) {
+        payload.string(variable);
+    }
+
+    const auto& instructions = expression.program.getInstructions();
+    payload.write(static_cast<std::uint32_t>(instructions.size()));
+
+    for (const auto& instruction : instructions) {
+        payload.write(static_cast<std::uint8_t>(instruction.op));
+        payload.write(instruction.a);
+        payload.write(instruction.b);
+        payload.write(instruction.c);
+        payload.write(instruction.value);
+    }
+
+    Writer entry;
+
+    if (!m_valid) {
+        entry.buffer().append(magic, sizeof(magic));
+        entry.write(formatVersion);
+        entry.write(byteOrderMark);
+
+        m_valid = true;
+    }
+
+    entry.write(static_cast<std::uint32_t>(payload.buffer().size()));
+    entry.buffer() += payload.buffer();
+
+    std::error_code error;
+
+    // Entries appended behind a damaged tail would never be indexed, it is cut off first.
+    // Only complete entries lie in front of it, so the mapping never reaches past the new end
+    if (m_end) {
+        std::filesystem::resize_file(m_file, *m_end, error);
+        m_end.reset();
+    }
+
+    // Written in one piece, a crash leaves at most a truncated last entry which the next start cuts off
+    {
+        std::ofstream file(m_file, std::ios::binary | std::ios::app);
+        file.write(entry.buffer().data(), static_cast<std::streamsize>(entry.buffer().size()));
+    }
+
+    // Independent of the umask, otherwise the next start would not trust the file
+    std::filesystem::permissions(m_file, std::filesystem::perms::group_write | std::filesystem::perms::others_write,
+                                 std::filesystem::perm_options::remove, error);
+}
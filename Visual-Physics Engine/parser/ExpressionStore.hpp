@@ -0,0 +1,93 @@
+//
+//  ExpressionStore.hpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#ifndef EXPRESSION_STORE_HPP
+#define EXPRESSION_STORE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Program.hpp"
+
+
+struct CompiledExpression;
+
+
+/// @class ExpressionStore
+/// @brief Versioned on-disk cache of compiled expressions, keyed by a hash of the normalized source.
+/// The file is memory mapped once when the store is opened and only its entry offsets are indexed,
+/// an entry is decoded when it is looked up. New entries are appended to the end of the file and
+/// are found by the next start, a damaged tail left by a crash is cut off before the first append.
+/// The file is only read if it belongs to the user and nobody else can write to it. Expressions
+/// loaded from the store carry their slot table and program but no body, CompiledExpression::tree
+/// parses the source again when a tree is needed.
+///
+/// Layout in native byte order, all counts are 32 bit:
+///   header:      "VPEX", format version, byte order mark
+///   entry:       payload size, 64 bit key hash, payload
+///   payload:     source, function name, parameter count, variables, instructions
+///   string:      length, characters
+///   instruction: opcode (8 bit), a, b, c, value (64 bit)
+class ExpressionStore {
+public:
+    // Bump whenever the layout, the opcodes or the semantics of compiled programs change
+    static constexpr std::uint32_t formatVersion = 5;
+
+public:
+    // A missing, truncated or outdated file is not an error, it is started from scratch
+    explicit ExpressionStore(std::filesystem::path file);
+    ~ExpressionStore();
+
+    ExpressionStore(const ExpressionStore&) = delete;
+    ExpressionStore& operator=(const ExpressionStore&) = delete;
+
+    // In the private cache directory of the user, empty if there is none
+    static std::filesystem::path defaultFile();
+
+    // nullptr if the source is not stored or its entry is damaged
+    std::shared_ptr<const CompiledExpression> load(std::string_view source) const;
+
+    // Appends the expression, sources that are already stored are skipped
+    void store(std::string_view source, const CompiledExpression& expression);
+
+    std::size_t size() const { return m_index.size(); }
+
+private:
+    void map();
+    void unmap();
+
+    void index();
+
+    std::shared_ptr<const CompiledExpression> decode(std::string_view source, std::size_t offset) const;
+
+private:
+    std::filesystem::path m_file;
+
+    // Mapping of the file at the time it was opened, never changed afterwards
+    const std::byte* m_data = nullptr;
+    std::size_t m_size = 0;
+
+    // Key hash to the payload offset in the mapping
+    std::unordered_map<std::uint64_t, std::size_t> m_index;
+
+    // Guards the appends, m_written holds the keys appended by this process
+    std::mutex m_mutex;
+    std::unordered_set<std::uint64_t> m_written;
+    bool m_valid = false;
+
+    // End of the last complete entry if a damaged tail follows it, cut off before the next append
+    std::optional<std::size_t> m_end;
+};
+
+#endif // EXPRESSION_STORE_HPP
@@ -0,0 +1,557 @@
+//
+//  NativeCompiler.cpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#include "NativeCompiler.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <dlfcn.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #define NATIVE_COMPILER_SUPPORTED 1
+#else
+    #define NATIVE_COMPILER_SUPPORTED 0
+#endif
+
+
+namespace {
+
+    // Part of the hashed source, bump it whenever the generated code changes
+    constexpr std::string_view generatorVersion = "2";
+
+    std::string literal(double value) {
+        if (std::isnan(value)) {
+            return "NAN";
+        }
+
+        if (std::isinf(value)) {
+            return value < 0 ? "-INFINITY" : "INFINITY";
+        }
+
+        // Hex floats keep the exact bits of the constant
+        char buffer[64];
+        std::snprintf(buffer, sizeof(buffer), "%a", value);
+
+        return buffer;
+    }
+
+    std::string expression(const Program::Instruction& in) {
+        std::string a = std::format("r{}", in.a);
+        std::string b = std::format("r{}", in.b);
+
+        switch (in.op) {
+            case Program::OpCode::Constant:
+                return literal(in.value);
+            case Program::OpCode::Variable:
+                return std::format("s[{}]", in.a);
+            case Program::OpCode::Add:
+                return a + " + " + b;
+            case Program::OpCode::Subtract:
+                return a + " - " + b;
+            case Program::OpCode::Multiply:
+                return a + " * " + b;
+            case Program::OpCode::Divide:
+                return std::format("{1} == 0 ? 0.0 : {0} / {1}", a, b);
+            case Program::OpCode::Power:
+                return std::format("pow({}, {})", a, b);
+            case Program::OpCode::Min:
+                return std::format("{1} < {0} ? {1} : {0}", a, b);
+            case Program::OpCode::Max:
+                return std::format("{0} < {1} ? {1} : {0}", a, b);
+            case Program::OpCode::Atan2:
+                return std::format("atan2({}, {})", a, b);
+            case Program::OpCode::Hypot:
+                return std::format("hypot({}, {})", a, b);
+            case Program::OpCode::Less:
+                return std::format("{} < {} ? 1.0 : 0.0", a, b);
+            case Program::OpCode::LessEqual:
+                return std::format("{} <= {} ? 1.0 : 0.0", a, b);
+            case Program::OpCode::Equal:
+                return std::format("{} == {} ? 1.0 : 0.0", a, b);
+            case Program::OpCode::NotEqual:
+                return std::format("{} != {} ? 1.0 : 0.0", a, b);
+            case Program::OpCode::And:
+                return std::format("{} != 0 && {} != 0 ? 1.0 : 0.0", a, b);
+            case Program::OpCode::Or:
+                return std::format("{} != 0 || {} != 0 ? 1.0 : 0.0", a, b);
+            case Program::OpCode::Select:
+                return std::format("{} != 0 ? {} : r{}", a, b, in.c);
+            case Program::OpCode::Negate:
+                return "-" + a;
+            case Program::OpCode::Sin:
+                return std::format("sin({})", a);
+            case Program::OpCode::Cos:
+                return std::format("cos({})", a);
+            case Program::OpCode::Tan:
+                return std::format("tan({})", a);
+            case Program::OpCode::Sqrt:
+                return std::format("{0} < 0 ? 0.0 : sqrt({0})", a);
+            case Program::OpCode::Exp:
+                return std::format("exp({})", a);
+            case Program::OpCode::Log:
+                return std::format("{0} <= 0 ? 0.0 : log({0})", a);
+            case Program::OpCode::Abs:
+                return std::format("fabs({})", a);
+            case Program::OpCode::Root:
+                return std::format("sqrt({})", a);
+            case Program::OpCode::Counter:
+            case Program::OpCode::Sum:
+            case Program::OpCode::Product:
+                break; // Loops are emitted as statements
+        }
+
+        throw std::runtime_error("Unknown opcode");
+    }
+
+    // Derivative of register i with respect to the slot, d{n} is the derivative of r{n}.
+    // Follows Program::executeTangents, scale() drops the terms whose coefficient is 0
+    std::string tangent(const Program::Instruction& in, std::size_t i) {
+        std::string a = std::format("r{}", in.a);
+        std::string b = std::format("r{}", in.b);
+        std::string r = std::format("r{}", i);
+        std::string da = std::format("d{}", in.a);
+        std::string db = std::format("d{}", in.b);
+
+        switch (in.op) {
+            case Program::OpCode::Constant:
+            case Program::OpCode::Counter:
+            case Program::OpCode::Less:
+            case Program::OpCode::LessEqual:
+            case Program::OpCode::Equal:
+            case Program::OpCode::NotEqual:
+            case Program::OpCode::And:
+            case Program::OpCode::Or:
+                return "0.0";
+            case Program::OpCode::Variable:
+                return std::format("slot == {} ? 1.0 : 0.0", in.a);
+            case Program::OpCode::Add:
+                return da + " + " + db;
+            case Program::OpCode::Subtract:
+                return da + " - " + db;
+            case Program::OpCode::Multiply:
+                return std::format("{} * {} + scale({}, {})", b, da, a, db);
+            case Program::OpCode::Divide:
+                return std::format("{1} == 0 ? 0.0 : 1.0 / {1} * {3} + scale(-{2} / {1}, {4})", a, b, r, da, db);
+            case Program::OpCode::Power:
+                return std::format("scale({3} != 0 ? {1} * pow({0}, {1} - 1) : 0.0, {3}) + scale({4} != 0 ? {2} * log({0}) : 0.0, {4})", a, b, r, da, db);
+            case Program::OpCode::Min:
+                return std::format("{} < {} ? {} : {}", b, a, db, da);
+            case Program::OpCode::Max:
+                return std::format("{} < {} ? {} : {}", a, b, db, da);
+            case Program::OpCode::Atan2:
+                return std::format("{0} * {0} + {1} * {1} == 0 ? 0.0 : {1} / ({0} * {0} + {1} * {1}) * {2} + scale(-{0} / ({0} * {0} + {1} * {1}), {3})", a, b, da, db);
+            case Program::OpCode::Hypot:
+                return std::format("{2} == 0 ? 0.0 : {0} / {2} * {3} + scale({1} / {2}, {4})", a, b, r, da, db);
+            case Program::OpCode::Select:
+                return std::format("{} != 0 ? {} : d{}", a, db, in.c);
+            case Program::OpCode::Negate:
+                return "-" + da;
+            case Program::OpCode::Sin:
+                return std::format("cos({}) * {}", a, da);
+            case Program::OpCode::Cos:
+                return std::format("-sin({}) * {}", a, da);
+            case Program::OpCode::Tan:
+                return std::format("(1.0 + {0} * {0}) * {1}", r, da);
+            case Program::OpCode::Sqrt:
+                return std::format("({0} == 0 ? 0.0 : 0.5 / {0}) * {1}", r, da);
+            case Program::OpCode::Exp:
+                return std::format("{} * {}", r, da);
+            case Program::OpCode::Log:
+                return std::format("({0} <= 0 ? 0.0 : 1.0 / {0}) * {1}", a, da);
+            case Program::OpCode::Abs:
+                return std::format("({0} > 0 ? 1.0 : {0} < 0 ? -1.0 : 0.0) * {1}", a, da);
+            case Program::OpCode::Root:
+                return std::format("0.5 / {} * {}", r, da);
+            case Program::OpCode::Sum:
+            case Program::OpCode::Product:
+                break; // Loops are emitted as statements
+        }
+
+        throw std::runtime_error("Unknown opcode");
+    }
+
+    // Statements computing every register of the program, with dual also the derivative of each
+    std::string statements(const std::vector<Program::Instruction>& instructions, bool dual) {
+
+        std::string code;
+
+        // Reduction that closes the loop of every counter
+        std::vector<std::size_t> loopEnd(instructions.size(), 0);
+
+        for (std::size_t i = 0; i < instructions.size(); ++i) {
+            if (instructions[i].op == Program::OpCode::Sum || instructions[i].op == Program::OpCode::Product) {
+                loopEnd[instructions[i].a] = i;
+            }
+        }
+
+        std::string indent = "    ";
+
+        for (std::size_t i = 0; i < instructions.size(); ++i) {
+
+            const Program::Instruction& in = instructions[i];
+
+            if (in.op == Program::OpCode::Counter) {
+
+                std::size_t end = loopEnd[i];
+                bool sum = instructions[end].op == Program::OpCode::Sum;
+
+                // Registers of a loop are assigned in every iteration, the outermost loop declares them
+                if (indent.size() == 4) {
+                    code += "    double ";
+
+                    for (std::size_t j = i; j <= end; ++j) {
+                        code += std::format("r{}{}", j, j == end ? ";\n" : ", ");
+                    }
+
+                    if (dual) {
+                        code += "    double ";
+
+                        for (std::size_t j = i; j <= end; ++j) {
+                            code += std::format("d{}{}", j, j == end ? ";\n" : ", ");
+                        }
+                    }
+                }
+
+                code += indent + std::format("r{} = {};\n", end, sum ? "0.0" : "1.0");
+
+                if (dual) {
+                    code += indent + std::format("d{} = 0.0;\n", end);
+                    code += indent + std::format("d{} = 0.0;\n", i);
+                }
+
+                code += indent + std::format("for (r{0} = {1}; r{0} <= {2}; r{0} += 1) {{\n", i, literal(in.value), literal(instructions[end].value));
+
+                indent += "    ";
+
+            } else if (in.op == Program::OpCode::Sum || in.op == Program::OpCode::Product) {
+
+                bool sum = in.op == Program::OpCode::Sum;
+
+                // The product rule needs the accumulator before it is multiplied
+                if (dual) {
+                    code += indent + (sum ? std::format("d{} += d{};\n", i, in.b) : std::format("d{0} = r{1} * d{0} + scale(r{0}, d{1});\n", i, in.b));
+                }
+
+                code += indent + std::format("r{} {}= r{};\n", i, sum ? '+' : '*', in.b);
+
+                indent.resize(indent.size() - 4);
+                code += indent + "}\n";
+
+            } else if (indent.size() > 4) {
+                code += indent + std::format("r{} = {};\n", i, expression(in));
+
+                if (dual) {
+                    code += indent + std::format("d{} = {};\n", i, tangent(in, i));
+                }
+            } else {
+                code += std::format("    const double r{} = {};\n", i, expression(in));
+
+                if (dual) {
+                    code += std::format("    const double d{} = {};\n", i, tangent(in, i));
+                }
+            }
+        }
+
+        return code;
+    }
+
+    std::string quoted(const std::filesystem::path& path) {
+        return "'" + path.string() + "'";
+    }
+}
+
+
+NativeKernel::NativeKernel(void* handle, Evaluate evaluate, EvaluateBatch evaluateBatch, EvaluateDual evaluateDual)
+    : m_handle(handle), m_evaluate(evaluate), m_evaluateBatch(evaluateBatch), m_evaluateDual(evaluateDual) {}
+
+NativeKernel::~NativeKernel() {
+#if NATIVE_COMPILER_SUPPORTED
+    if (m_handle) {
+        dlclose(m_handle);
+    }
+#endif
+}
+
+void NativeKernel::evaluateBatch(std::span<const double> xs, std::span<double> ys, const Context& context, std::size_t slot) const {
+
+    if (xs.size() != ys.size()) {
+        throw std::invalid_argument("Batch input and output sizes differ");
+    }
+
+    m_evaluateBatch(xs.data(), ys.data(), xs.size(), context.slots.data(), slot);
+}
+
+Dual NativeKernel::evaluateDual(const Context& context, std::size_t slot) const {
+
+    Dual result;
+    result.value = m_evaluateDual(context.slots.data(), slot, &result.derivative);
+
+    return result;
+}
+
+
+bool NativeCompiler::available() {
+#if NATIVE_COMPILER_SUPPORTED
+    static const bool available = std::system(nullptr) &&
+                                  std::system((compiler() + " --version > /dev/null 2>&1").c_str()) == 0;
+    return available;
+#else
+    return false;
+#endif
+}
+
+std::string NativeCompiler::source(const Program& program) {
+
+    const auto& instructions = program.getInstructions();
+
+    std::string code = std::format("/* Generated by Visual-Physics Engine, generator version {} */\n", generatorVersion);
+
+    code += "#include <math.h>\n";
+    code += "#include <stddef.h>\n";
+    code += "#include <string.h>\n\n";
+
+    code += "/* c * d, 0 where the coefficient is 0 so 0 * inf never appears */\n";
+    code += "static inline double scale(double c, double d) {\n";
+    code += "    return c != 0 ? c * d : 0.0;\n";
+    code += "}\n\n";
+
+    code += "static inline double body(const double* s) {\n";
+    code += statements(instructions, false);
+    code += instructions.empty() ? "    return 0.0;\n" : std::format("    return r{};\n", instructions.size() - 1);
+    code += "}\n\n";
+
+    code += "double evaluate(const double* s) {\n";
+    code += "    return body(s);\n";
+    code += "}\n\n";
+
+    code += "void evaluateBatch(const double* xs, double* ys, size_t count, const double* slots, size_t slot) {\n";
+    code += std::format("    double s[{}];\n", Context::capacity);
+    code += "    memcpy(s, slots, sizeof(s));\n\n";
+    code += "    for (size_t i = 0; i < count; ++i) {\n";
+    code += "        s[slot] = xs[i];\n";
+    code += "        ys[i] = body(s);\n";
+    code += "    }\n";
+    code += "}\n\n";
+
+    code += "double evaluateDual(const double* s, size_t slot, double* derivative) {\n";
+    code += statements(instructions, true);
+
+    if (instructions.empty()) {
+        code += "    *derivative = 0.0;\n";
+        code += "    return 0.0;\n";
+    } else {
+        code += std::format("    *derivative = d{};\n", instructions.size() - 1);
+        code += std::format("    return r{};\n", instructions.size() - 1);
+    }
+
+    code += "}\n";
+
+    return code;
+}
+
+std::uint64_t NativeCompiler::hash(std::string_view text) {
+
+    // FNV-1a, stable between runs unlike std::hash
+    std::uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (char c : text) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+std::shared_ptr<NativeKernel> NativeCompiler::compile(const Program& program) {
+
+    std::string code = source(program);
+
+    std::filesystem::path directory = cacheDirectory();
+
+    // Without a directory only this user can write to, nothing is built or loaded
+    if (directory.empty()) {
+        return nullptr;
+    }
+
+    std::filesystem::path library = directory / std::format("{:016x}.so", hash(code));
+
+    std::error_code error;
+
+    if (std::filesystem::exists(library, error)) {
+
+        // A library somebody else could have written is never loaded, it is built again
+        if (isPrivate(library)) {
+            if (auto kernel = load(library)) {
+                return kernel;
+            }
+        }
+
+        std::filesystem::remove(library, error);
+    }
+
+    if (!available()) {
+        return nullptr;
+    }
+
+    // Built under a unique name and renamed afterwards, so concurrent builds never load half written files
+    std::string unique = std::format("{:016x}.{:x}", hash(code), std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    std::filesystem::path sourceFile = directory / (unique + ".c");
+    std::filesystem::path temporary = directory / (unique + ".so");
+
+    {
+        std::ofstream file(sourceFile);
+        file << code;
+
+        if (!file) {
+            return nullptr;
+        }
+    }
+
+    std::string command = std::format("{} -std=c11 -O2 -fPIC -shared -o {} {} -lm > /dev/null 2>&1",
+                                      compiler(), quoted(temporary), quoted(sourceFile));
+
+    bool compiled = std::system(command.c_str()) == 0;
+
+    std::filesystem::remove(sourceFile, error);
+
+    if (!compiled) {
+        std::filesystem::remove(temporary, error);
+        return nullptr;
+    }
+
+    // Independent of the umask, otherwise the next start would refuse to load it
+    std::filesystem::permissions(temporary, std::filesystem::perms::group_write | std::filesystem::perms::others_write,
+                                 std::filesystem::perm_options::remove, error);
+
+    std::filesystem::rename(temporary, library, error);
+
+    if (error) {
+        std::filesystem::remove(temporary, error);
+        return nullptr;
+    }
+
+    return load(library);
+}
+
+std::future<std::shared_ptr<NativeKernel>> NativeCompiler::compileAsync(Program program) {
+
+    std::promise<std::shared_ptr<NativeKernel>> promise;
+    auto future = promise.get_future();
+
+    // Not on the ThreadManager, the compiler would block a plotting worker for a long time.
+    // Unlike one from std::async the future does not wait for the build when it is dropped,
+    // the thread finishes on its own and its result is discarded
+    std::thread([promise = std::move(promise), program = std::move(program)]() mutable {
+        try {
+            promise.set_value(compile(program));
+        } catch (const std::exception&) {
+            promise.set_value(nullptr);
+        }
+    }).detach();
+
+    return future;
+}
+
+std::string NativeCompiler::compiler() {
+    const char* cc = std::getenv("CC");
+
+    return cc && *cc ? cc : "cc";
+}
+
+std::filesystem::path NativeCompiler::userCacheDirectory() {
+#if NATIVE_COMPILER_SUPPORTED
+    std::filesystem::path base;
+
+    // A relative XDG_CACHE_HOME is invalid by the specification and ignored
+    if (const char* cache = std::getenv("XDG_CACHE_HOME"); cache && *cache == '/') {
+        base = cache;
+    } else if (const char* home = std::getenv("HOME"); home && *home) {
+        base = std::filesystem::path(home) / ".cache";
+    } else {
+        return {};
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(base, error);
+
+    return privateDirectory(base / "visual-physics-engine");
+#else
+    // The temp directory is per user on the platforms without a native tier
+    std::error_code error;
+    std::filesystem::path directory = std::filesystem::temp_directory_path(error) / "visual-physics-engine";
+    std::filesystem::create_directories(directory, error);
+
+    return error ? std::filesystem::path() : directory;
+#endif
+}
+
+bool NativeCompiler::isPrivate(const std::filesystem::path& path) {
+#if NATIVE_COMPILER_SUPPORTED
+    struct stat status;
+
+    // A symbolic link is rejected, its target could be anywhere
+    return ::lstat(path.c_str(), &status) == 0 && !S_ISLNK(status.st_mode) &&
+           status.st_uid == ::getuid() && (status.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+#else
+    return true;
+#endif
+}
+
+std::filesystem::path NativeCompiler::privateDirectory(const std::filesystem::path& directory) {
+    std::error_code error;
+
+#if NATIVE_COMPILER_SUPPORTED
+    // Fails if it exists, the checks below decide whether an existing one can be used
+    ::mkdir(directory.c_str(), 0700);
+#else
+    std::filesystem::create_directory(directory, error);
+#endif
+
+    if (!std::filesystem::is_directory(directory, error) || !isPrivate(directory)) {
+        return {};
+    }
+
+    return directory;
+}
+
+std::filesystem::path NativeCompiler::cacheDirectory() {
+    std::filesystem::path base = userCacheDirectory();
+
+    return base.empty() ? base : privateDirectory(base / "native");
+}
+
+std::shared_ptr<NativeKernel> NativeCompiler::load(const std::filesystem::path& library) {
+#if NATIVE_COMPILER_SUPPORTED
+    void* handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+    if (!handle) {
+        return nullptr;
+    }
+
+    auto evaluate = reinterpret_cast<NativeKernel::Evaluate>(dlsym(handle, "evaluate"));
+    auto evaluateBatch = reinterpret_cast<NativeKernel::EvaluateBatch>(dlsym(handle, "evaluateBatch"));
+    auto evaluateDual = reinterpret_cast<NativeKernel::EvaluateDual>(dlsym(handle, "evaluateDual"));
+
+    if (!evaluate || !evaluateBatch || !evaluateDual) {
+        dlclose(handle);
+        return nullptr;
+    }
+
+    return std::make_shared<NativeKernel>(handle, evaluate, evaluateBatch, evaluateDual);
+#else
+    return nullptr;
+#endif
+}
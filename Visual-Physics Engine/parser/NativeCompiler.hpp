@@ -0,0 +1,91 @@
+//
+//  NativeCompiler.hpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#ifndef NATIVE_COMPILER_HPP
+#define NATIVE_COMPILER_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "Program.hpp"
+
+
+/// @class NativeKernel
+/// @brief Machine code of one program, loaded from a shared library.
+/// Evaluates exactly like Program, including the guarded builtins, but without the dispatch loop.
+class NativeKernel {
+public:
+    using Evaluate = double (*)(const double* slots);
+    using EvaluateBatch = void (*)(const double* xs, double* ys, std::size_t count, const double* slots, std::size_t slot);
+
+    // Returns the value and writes the derivative with respect to the slot, like Program::evaluateDual
+    using EvaluateDual = double (*)(const double* slots, std::size_t slot, double* derivative);
+
+public:
+    NativeKernel(void* handle, Evaluate evaluate, EvaluateBatch evaluateBatch, EvaluateDual evaluateDual);
+    ~NativeKernel();
+
+    NativeKernel(const NativeKernel&) = delete;
+    NativeKernel& operator=(const NativeKernel&) = delete;
+
+    double evaluate(const Context& context) const { return m_evaluate(context.slots.data()); }
+
+    void evaluateBatch(std::span<const double> xs, std::span<double> ys, const Context& context, std::size_t slot) const;
+
+    Dual evaluateDual(const Context& context, std::size_t slot) const;
+
+private:
+    void* m_handle;
+
+    Evaluate m_evaluate;
+    EvaluateBatch m_evaluateBatch;
+    EvaluateDual m_evaluateDual;
+};
+
+
+/// @class NativeCompiler
+/// @brief Opt-in JIT tier, translates a program to C and builds it with the system compiler.
+/// The compiler is taken from the CC environment variable and defaults to cc. Libraries are
+/// cached in the private cache directory of the user by a hash of the generated source, so a later
+/// start only loads them. A library that is not owned by the user or that others can write is rebuilt.
+class NativeCompiler {
+public:
+    static bool available();
+
+    static std::string source(const Program& program);
+    static std::uint64_t hash(std::string_view text);
+
+    // Blocks until the kernel is built or loaded from the cache, nullptr if that is not possible
+    static std::shared_ptr<NativeKernel> compile(const Program& program);
+
+    // Same as compile on a detached background thread, the program is copied.
+    // Dropping the future never blocks, a build nobody waits for anymore is discarded
+    static std::future<std::shared_ptr<NativeKernel>> compileAsync(Program program);
+
+    // $XDG_CACHE_HOME/visual-physics-engine or ~/.cache/visual-physics-engine, created with mode 0700.
+    // Empty if it cannot be created or is not private to the user, nothing is cached then
+    static std::filesystem::path userCacheDirectory();
+
+    // Owned by the current user, not writable by group or others and not a symbolic link
+    static bool isPrivate(const std::filesystem::path& path);
+
+private:
+    static std::string compiler();
+
+    // Creates the directory with mode 0700, empty if it is not private to the user
+    static std::filesystem::path privateDirectory(const std::filesystem::path& directory);
+    static std::filesystem::path cacheDirectory();
+
+    static std::shared_ptr<NativeKernel> load(const std::filesystem::path& library);
+};
+
+#endif // NATIVE_COMPILER_HPP
@@ -0,0 +1,414 @@
+//
+//  Optimizer.cpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#include "Optimizer.hpp"
+
+#include <cmath>
+#include <functional>
+
+
+ASTNode* Optimizer::optimize(ASTNode* node, Arena& arena) const {
+
+    if (!node) {
+        return node;
+    }
+
+    if (auto* header = dynamic_cast<FunctionHeaderNode*>(node)) {
+
+        header->setBody(optimize(header->body, arena));
+        return node;
+
+    } else if (auto* binary = dynamic_cast<BinaryOperationNode*>(node)) {
+
+        binary->left = optimize(binary->left, arena);
+        binary->right = optimize(binary->right, arena);
+        return optimizeBinary(binary, arena);
+
+    } else if (auto* function = dynamic_cast<FunctionNode*>(node)) {
+
+        function->argument = optimize(function->argument, arena);
+
+        if (isConstant(*function->argument)) {
+            return arena.make<ConstantNode>(function->evaluate(Context{}));
+        }
+        return node;
+
+    } else if (auto* call = dynamic_cast<BinaryCallNode*>(node)) {
+
+        return optimizeCall(call, arena);
+
+    } else if (auto* call = dynamic_cast<TernaryCallNode*>(node)) {
+
+        return optimizeCall(call, arena);
+
+    } else if (auto* condition = dynamic_cast<ConditionNode*>(node)) {
+
+        condition->left = optimize(condition->left, arena);
+        condition->right = optimize(condition->right, arena);
+
+        if (isConstant(*condition->left) && isConstant(*condition->right)) {
+            return arena.make<ConstantNode>(condition->evaluate(Context{}));
+        }
+        return node;
+
+    } else if (auto* negation = dynamic_cast<NegationNode*>(node)) {
+
+        negation->m_node = optimize(negation->m_node, arena);
+        return optimizeNegation(negation, arena);
+
+    } else if (auto* series = dynamic_cast<SeriesNode*>(node)) {
+
+        series->first = optimize(series->first, arena);
+        series->last = optimize(series->last, arena);
+        series->term = optimize(series->term, arena);
+
+        // A constant term repeats the same value, e.g. a series written for a single term
+        if (isConstant(*series->first) && isConstant(*series->last) && isConstant(*series->term)) {
+            return arena.make<ConstantNode>(series->evaluate(Context{}));
+        }
+        return node;
+
+    } else if (auto* invoke = dynamic_cast<InvokeNode*>(node)) {
+
+        bool constant = true;
+
+        for (auto& argument : invoke->arguments) {
+            argument = optimize(argument, arena);
+            constant = constant && isConstant(*argument);
+        }
+
+        // The body of the callee is opaque here, only a call with constant arguments is folded
+        if (constant) {
+            return arena.make<ConstantNode>(invoke->evaluate(Context{}));
+        }
+        return node;
+    }
+
+    return node;
+}
+
+template<std::size_t Arity>
+ASTNode* Optimizer::optimizeCall(CallNode<Arity>* call, Arena& arena) const {
+
+    bool constant = true;
+
+    for (auto& argument : call->arguments) {
+        argument = optimize(argument, arena);
+        constant = constant && isConstant(*argument);
+    }
+
+    if (constant) {
+        return arena.make<ConstantNode>(call->evaluate(Context{}));
+    }
+
+    // A constant condition decides the branch, the other one is dropped
+    if constexpr (Arity == 3) {
+        if (call->function == Builtin::If && isConstant(*call->arguments[0])) {
+            return call->arguments[0]->evaluate(Context{}) != 0 ? call->arguments[1] : call->arguments[2];
+        }
+    }
+
+    // pow(a, b) is a ^ b and gets the same rewrites, e.g. the expansion of small integer exponents
+    if constexpr (Arity == 2) {
+        if (call->function == Builtin::Pow) {
+            return optimizeBinary(arena.make<BinaryOperationNode>(call->arguments[0], call->arguments[1], '^'), arena);
+        }
+    }
+
+    return call;
+}
+
+ASTNode* Optimizer::optimizeBinary(BinaryOperationNode* binary, Arena& arena) const {
+
+    // Constant folding uses the regular evaluation, so the guarded semantics stay the same
+    if (isConstant(*binary->left) && isConstant(*binary->right)) {
+        return arena.make<ConstantNode>(binary->evaluate(Context{}));
+    }
+
+    switch (binary->operation) {
+        case '+':
+            if (isConstant(*binary->left, 0.0)) {
+                return binary->right;
+            }
+            if (isConstant(*binary->right, 0.0)) {
+                return binary->left;
+            }
+            break;
+
+        case '-':
+            if (isConstant(*binary->right, 0.0)) {
+                return binary->left;
+            }
+            if (isConstant(*binary->left, 0.0)) {
+                return negate(binary->right, arena);
+            }
+            break;
+
+        case '*':
+            if (isConstant(*binary->left, 1.0)) {
+                return binary->right;
+            }
+            if (isConstant(*binary->right, 1.0)) {
+                return binary->left;
+            }
+            if (isConstant(*binary->left, -1.0)) {
+                return negate(binary->right, arena);
+            }
+            if (isConstant(*binary->right, -1.0)) {
+                return negate(binary->left, arena);
+            }
+            break;
+
+        case '/':
+            if (isConstant(*binary->right, 1.0)) {
+                return binary->left;
+            }
+            break;
+
+        case '^':
+            if (isConstant(*binary->left, 1.0) || isConstant(*binary->right, 0.0)) {
+                return arena.make<ConstantNode>(1.0);
+            }
+            if (isConstant(*binary->right)) {
+
+                double exponent = static_cast<const ConstantNode&>(*binary->right).value;
+
+                if (exponent == 0.5) {
+                    // pow(x, 0.5) is nan for negative x, unlike the guarded sqrt builtin
+                    return arena.make<FunctionNode>(Builtin::Root, binary->left);
+                }
+                if (exponent >= 1.0 && exponent <= m_maxExpandedPower && exponent == std::floor(exponent)) {
+                    return power(*binary->left, static_cast<int>(exponent), arena);
+                }
+            }
+            break;
+    }
+
+    if (binary->operation == '+' || binary->operation == '*') {
+
+        canonicalize(*binary);
+
+        // c1 op (c2 op y) -> (c1 op c2) op y, constants are always the left operand after canonicalize
+        auto* inner = dynamic_cast<BinaryOperationNode*>(binary->right);
+
+        if (isConstant(*binary->left) && inner && inner->operation == binary->operation && isConstant(*inner->left)) {
+
+            BinaryOperationNode constants(binary->left, inner->left, binary->operation);
+            binary->left = arena.make<ConstantNode>(constants.evaluate(Context{}));
+            binary->right = inner->right;
+
+            return optimizeBinary(binary, arena);
+        }
+    }
+
+    return binary;
+}
+
+ASTNode* Optimizer::optimizeNegation(NegationNode* negation, Arena& arena) const {
+
+    if (isConstant(*negation->m_node)) {
+        return arena.make<ConstantNode>(negation->evaluate(Context{}));
+    }
+
+    // -(-x) -> x
+    if (auto* inner = dynamic_cast<NegationNode*>(negation->m_node)) {
+        return inner->m_node;
+    }
+
+    if (auto* variable = dynamic_cast<VariableNode*>(negation->m_node)) {
+        variable->m_negative = !variable->m_negative;
+        return variable;
+    }
+
+    return negation;
+}
+
+ASTNode* Optimizer::negate(ASTNode* node, Arena& arena) const {
+    return optimizeNegation(arena.make<NegationNode>(node), arena);
+}
+
+ASTNode* Optimizer::power(const ASTNode& base, int exponent, Arena& arena) const {
+
+    if (exponent == 1) {
+        return base.clone(arena);
+    }
+
+    // Square and multiply, the duplicated subtrees are shared again when compiling
+    if (exponent % 2 == 0) {
+        ASTNode* half = power(base, exponent / 2, arena);
+        return arena.make<BinaryOperationNode>(half, half->clone(arena), '*');
+    }
+
+    ASTNode* rest = power(base, exponent - 1, arena);
+    return arena.make<BinaryOperationNode>(rest, base.clone(arena), '*');
+}
+
+void Optimizer::canonicalize(BinaryOperationNode& binary) const {
+    if (compare(*binary.right, *binary.left) < 0) {
+        std::swap(binary.left, binary.right);
+    }
+}
+
+bool Optimizer::isConstant(const ASTNode& node) {
+    return dynamic_cast<const ConstantNode*>(&node) != nullptr;
+}
+
+bool Optimizer::isConstant(const ASTNode& node, double value) {
+    auto* constant = dynamic_cast<const ConstantNode*>(&node);
+    return constant && constant->value == value;
+}
+
+int Optimizer::rank(const ASTNode& node) {
+    if (dynamic_cast<const ConstantNode*>(&node)) {
+        return 0;
+    }
+    if (dynamic_cast<const VariableNode*>(&node)) {
+        return 1;
+    }
+    if (dynamic_cast<const FunctionNode*>(&node)) {
+        return 2;
+    }
+    if (dynamic_cast<const NegationNode*>(&node)) {
+        return 3;
+    }
+    if (dynamic_cast<const BinaryCallNode*>(&node)) {
+        return 5;
+    }
+    if (dynamic_cast<const TernaryCallNode*>(&node)) {
+        return 6;
+    }
+    if (dynamic_cast<const ConditionNode*>(&node)) {
+        return 7;
+    }
+    if (dynamic_cast<const InvokeNode*>(&node)) {
+        return 8;
+    }
+    if (dynamic_cast<const SeriesNode*>(&node)) {
+        return 9;
+    }
+    return 4;
+}
+
+int Optimizer::compare(const ASTNode& lhs, const ASTNode& rhs) {
+
+    // Constants first, then variables in slot order, then the rest structurally
+    int lhsRank = rank(lhs);
+    int rhsRank = rank(rhs);
+
+    if (lhsRank != rhsRank) {
+        return lhsRank < rhsRank ? -1 : 1;
+    }
+
+    auto order = [](auto a, auto b) { return a < b ? -1 : (b < a ? 1 : 0); };
+
+    switch (lhsRank) {
+        case 0:
+            return order(static_cast<const ConstantNode&>(lhs).value, static_cast<const ConstantNode&>(rhs).value);
+
+        case 1: {
+            auto& a = static_cast<const VariableNode&>(lhs);
+            auto& b = static_cast<const VariableNode&>(rhs);
+
+            return a.m_slot != b.m_slot ? order(a.m_slot, b.m_slot) : order(a.m_negative, b.m_negative);
+        }
+
+        case 2: {
+            auto& a = static_cast<const FunctionNode&>(lhs);
+            auto& b = static_cast<const FunctionNode&>(rhs);
+
+            return a.function != b.function ? order(a.function, b.function) : compare(*a.argument, *b.argument);
+        }
+
+        case 3:
+            return compare(*static_cast<const NegationNode&>(lhs).m_node, *static_cast<const NegationNode&>(rhs).m_node);
+
+        case 5:
+            return compareCall(static_cast<const BinaryCallNode&>(lhs), static_cast<const BinaryCallNode&>(rhs));
+
+        case 6:
+            return compareCall(static_cast<const TernaryCallNode&>(lhs), static_cast<const TernaryCallNode&>(rhs));
+
+        case 7: {
+            auto& a = static_cast<const ConditionNode&>(lhs);
+            auto& b = static_cast<const ConditionNode&>(rhs);
+
+            if (a.condition != b.condition) {
+                return order(a.condition, b.condition);
+            }
+
+            int left = compare(*a.left, *b.left);
+            return left != 0 ? left : compare(*a.right, *b.right);
+        }
+
+        case 8: {
+            auto& a = static_cast<const InvokeNode&>(lhs);
+            auto& b = static_cast<const InvokeNode&>(rhs);
+
+            if (a.callee != b.callee) {
+                return std::less<>{}(a.callee, b.callee) ? -1 : 1;
+            }
+
+            // Same callee, so the same number of arguments
+            for (std::size_t i = 0; i < a.arguments.size(); ++i) {
+                if (int argument = compare(*a.arguments[i], *b.arguments[i]); argument != 0) {
+                    return argument;
+                }
+            }
+
+            return 0;
+        }
+
+        case 9: {
+            auto& a = static_cast<const SeriesNode&>(lhs);
+            auto& b = static_cast<const SeriesNode&>(rhs);
+
+            if (a.function != b.function || a.index->m_slot != b.index->m_slot) {
+                return a.function != b.function ? order(a.function, b.function) : order(a.index->m_slot, b.index->m_slot);
+            }
+
+            for (auto [x, y] : {std::pair{a.first, b.first}, std::pair{a.last, b.last}, std::pair{a.term, b.term}}) {
+                if (int part = compare(*x, *y); part != 0) {
+                    return part;
+                }
+            }
+
+            return 0;
+        }
+
+        default: {
+            auto* a = dynamic_cast<const BinaryOperationNode*>(&lhs);
+            auto* b = dynamic_cast<const BinaryOperationNode*>(&rhs);
+
+            if (!a || !b) {
+                return 0;
+            }
+
+            if (a->operation != b->operation) {
+                return order(a->operation, b->operation);
+            }
+
+            int left = compare(*a->left, *b->left);
+            return left != 0 ? left : compare(*a->right, *b->right);
+        }
+    }
+}
+
+template<std::size_t Arity>
+int Optimizer::compareCall(const CallNode<Arity>& lhs, const CallNode<Arity>& rhs) {
+
+    if (lhs.function != rhs.function) {
+        return lhs.function < rhs.function ? -1 : 1;
+    }
+
+    for (std::size_t i = 0; i < Arity; ++i) {
+        if (int order = compare(*lhs.arguments[i], *rhs.arguments[i]); order != 0) {
+            return order;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,54 @@
+//
+//  Optimizer.hpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#ifndef OPTIMIZER_HPP
+#define OPTIMIZER_HPP
+
+#include <utility>
+
+#include "AST.hpp"
+
+
+/// @class Optimizer
+/// @brief Simplifies a parsed tree once, so the rewritten parts are not evaluated per sample.
+/// Folds constant subtrees, removes neutral elements, reduces small integer powers to
+/// multiplications and brings commutative operations into a canonical operand order.
+class Optimizer {
+public:
+    Optimizer() = default;
+
+    // Rewrites the tree in place, new nodes are allocated in the given arena
+    ASTNode* optimize(ASTNode* node, Arena& arena) const;
+
+private:
+    ASTNode* optimizeBinary(BinaryOperationNode* binary, Arena& arena) const;
+    ASTNode* optimizeNegation(NegationNode* negation, Arena& arena) const;
+
+    template<std::size_t Arity>
+    ASTNode* optimizeCall(CallNode<Arity>* call, Arena& arena) const;
+
+    ASTNode* negate(ASTNode* node, Arena& arena) const;
+    ASTNode* power(const ASTNode& base, int exponent, Arena& arena) const;
+
+    void canonicalize(BinaryOperationNode& binary) const;
+
+    static bool isConstant(const ASTNode& node);
+    static bool isConstant(const ASTNode& node, double value);
+
+    // Total order used to sort the operands of commutative operations, no allocations
+    static int rank(const ASTNode& node);
+    static int compare(const ASTNode& lhs, const ASTNode& rhs);
+
+    template<std::size_t Arity>
+    static int compareCall(const CallNode<Arity>& lhs, const CallNode<Arity>& rhs);
+
+private:
+    // Integer powers up to this exponent are expanded into multiplications
+    static constexpr int m_maxExpandedPower = 16;
+};
+
+#endif // OPTIMIZER_HPP
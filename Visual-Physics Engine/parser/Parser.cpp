@@ -7,423 +7,617 @@
 
 #include "Parser.hpp"
 
+#include <algorithm>
 #include <print>
 
-Parser::Parser()
-    : m_tokenizer("") {
-}
+#include "ExpressionCache.hpp"
+
 
 void Parser::setExpression(const std::string& expression) {
     m_expression = expression;
-    m_tokenizer.setNewText(expression);
 }
 
-std::unique_ptr<ASTNode> Parser::parse() {
+Expression Parser::parse() {
+    
+    // Tokens are views into m_expression, the shunting yard reads them in place
+    m_tokenizer.setNewText(m_expression);
     m_tokenizer.tokenize();
 
-    m_tokens = m_tokenizer.getTokens();
+    m_shuntingYard.setTokens(m_tokenizer.getTokens());
+    
+    m_scratch.release();
 
-    m_shuntingYard.setTokens(m_tokens);
+    ASTNode* root = m_optimizer.optimize(m_shuntingYard.parse(m_scratch), m_scratch);
+    
+    // The copy drops nodes replaced by the optimizer and sizes the arena for the source
+    return Expression::copy(*root, m_expression.size() * 64 + 256);
+}
 
-    return m_shuntingYard.parse();
+const std::vector<std::string>& Parser::getVariables() const {
+    return m_shuntingYard.getVariables();
 }
 
-void ShuntingYard::setTokens(const std::vector<std::pair<std::string, Tokenizer::TokenType>>& tokens) {
+void ShuntingYard::setTokens(std::span<const Token> tokens) {
     m_tokens = tokens;
 }
 
-std::unique_ptr<ASTNode> ShuntingYard::parse() {
+ASTNode* ShuntingYard::parse(Arena& arena) {
     
-    std::stack<std::pair<std::string, Tokenizer::TokenType>> opStack;
-    std::stack<std::unique_ptr<ASTNode>> outputStack;
-
-    std::unique_ptr<FunctionHeaderNode> funcHeaderNode;
-
-    //Function definitions
-    if (m_tokens[0].second == Tokenizer::TokenType::Identifier &&
-        m_tokens[1].second == Tokenizer::TokenType::BracketOpen) {
+    std::stack<Token> opStack;
+    std::stack<ASTNode*> outputStack;
     
-        std::string functionName = m_tokens[0].first;
-        std::vector<std::string> parameters;
-
-        int i = 2;
-        while (m_tokens[i].second == Tokenizer::TokenType::Identifier) {
-            
-            parameters.push_back(m_tokens[i].first);
+    // One entry per open bracket, the number of arguments for a call and 0 for plain brackets
+    std::stack<std::size_t> argumentCounts;
 
-            if (m_tokens[i + 2].second == Tokenizer::TokenType::Identifier) {
-                i += 2;
-            } else {
-                i++;
-            }
-        }
-
-        funcHeaderNode = std::make_unique<FunctionHeaderNode>(functionName, parameters);
+    FunctionHeaderNode* funcHeaderNode = nullptr;
+    
+    m_arena = &arena;
+    m_variables.clear();
+    m_indices.clear();
+    m_dependencies.clear();
 
-        for (int j = 0; j < i + 2; ++j) {
-            
-            // Remove tokens used for function header
-            m_tokens.erase(m_tokens.begin());
-        }
-    }
+    //Function definitions
+    std::size_t begin = parseFunctionHeader(funcHeaderNode);
+    m_header = funcHeaderNode;
     
-    std::pair<std::string, Tokenizer::TokenType> lastToken = {"", Tokenizer::TokenType::Unknown};
+    // An operand is expected at the start, after operators and after opening brackets.
+    // A + or - in that position is a sign and not a binary operator.
+    bool expectOperand = true;
     
-    for (int i = 0; i < m_tokens.size(); ++i) {
-        /*
-        std::print("\n{}: ", i);
-        for (int j = i; j < m_tokens.size(); j++) {
-            std::print("{}", m_tokens[j].first);
-        }
-        std::print("\n");
-        if (!outputStack.empty())
-            std::print("Output Stack top: {}\n", outputStack.top()->toString());
-        if (!opStack.empty())
-            std::print("Op Stack top    : {}\n", opStack.top().first);
-        */
-        auto& token = m_tokens[i];
-        
-        if (token.second == Tokenizer::TokenType::Number) {
-            
-            for (int j = i + 1; j < m_tokens.size(); ++j) {
+    for (std::size_t i = begin; i < m_tokens.size(); ++i) {
+        
+        const Token& token = m_tokens[i];
+        
+        switch (token.type) {
+            case TokenType::Number:
                 
-                // Check if the next token is a number or a dot
-                if (m_tokens[j].second == Tokenizer::TokenType::Number || m_tokens[j].second == Tokenizer::TokenType::Punctuation) {
-                    
-                    // Append the next token to the current number
-                    token.first += m_tokens[j].first;
-                    
-                    // Remove the next token from the list
-                    i++;
-                    
-                } else {
-                    
-                    break;
+                if (!expectOperand) {
+                    unexpected(token);
                 }
-            }
-            
-            // Push the number to the output stack as a ConstantNode
-            if (lastToken.second == Tokenizer::TokenType::UnaryOperator){
                 
-                outputStack.push(std::make_unique<ConstantNode>(std::stod(lastToken.first + token.first)));
+                outputStack.push(arena.make<ConstantNode>(token.value));
+                expectOperand = false;
+                break;
                 
-            } else {
+            case TokenType::Identifier:
                 
-                outputStack.push(std::make_unique<ConstantNode>(std::stod(token.first)));
-            }
-            
-            lastToken = token;
-            
-        } else if (token.second == Tokenizer::TokenType::BinaryPMOperator ||
-                   token.second == Tokenizer::TokenType::BinaryMDOperator ||
-                   token.second == Tokenizer::TokenType::BinaryPowerOperator) {
-            
-            if (token.second == Tokenizer::TokenType::BinaryPMOperator &&
-                (lastToken.second == Tokenizer::TokenType::BinaryPMOperator ||
-                lastToken.second == Tokenizer::TokenType::BinaryMDOperator ||
-                lastToken.second == Tokenizer::TokenType::BinaryPowerOperator ||
-                lastToken.second == Tokenizer::TokenType::Unknown ||
-                lastToken.second == Tokenizer::TokenType::BracketOpen)) {
-                
-                lastToken = token;
-                lastToken.second = Tokenizer::TokenType::UnaryOperator;
-                
-                if (lastToken.first == "-") {
-                    
-                    opStack.push(lastToken);
+                if (!expectOperand) {
+                    unexpected(token);
                 }
                 
-            } else {
+                // A function call consumes its opening bracket and still needs the argument
+                expectOperand = parseIdentifier(i, opStack, outputStack);
                 
-                pushToOpStack(opStack, outputStack, token, lastToken);
-
-            }
-        } else if (token.second == Tokenizer::TokenType::Identifier) {
-            
-            bool isFunction = false;
-            
-            // Check if the identifier is a function
-            for (const auto& func : m_functions) {
+                if (expectOperand) {
+                    argumentCounts.push(1);
+                }
+                break;
                 
-                isFunction = true;
+            case TokenType::BinaryPMOperator:
                 
-                // Check if the identifier matches the function name
-                for (int j = 0; j < func.size(); ++j) {
+                if (expectOperand) {
                     
-                    // Prevent out of bounds access
-                    if (j + i > m_tokens.size() - 1) {
-                        
-                        isFunction = false;
-                        break;
-                    }
-                    
-                    // Compare the tokens with the function name
-                    if (m_tokens[i + j].first[0] != func[j]) {
-                        
-                        isFunction = false;
-                        break;
+                    // Leading plus does nothing
+                    if (token.text == "-") {
+                        opStack.push(Token{TokenType::UnaryOperator, token.text, token.offset});
                     }
+                    break;
                 }
                 
-                if (isFunction) {
-                    
-                    // Set the token type to Function
-                    lastToken = token;
-                    token.first = func;
-                    token.second = Tokenizer::TokenType::Function;
+                pushToOpStack(opStack, outputStack, token);
+                expectOperand = true;
+                break;
+                
+            case TokenType::BinaryMDOperator:
+            case TokenType::BinaryPowerOperator:
+                
+                if (expectOperand) {
+                    unexpected(token);
+                }
+                
+                pushToOpStack(opStack, outputStack, token);
+                expectOperand = true;
+                break;
+                
+            case TokenType::Delimiter:
+                
+                if (expectOperand) {
                     
-                    while ((isLeftAssociative(token.first[0]) && precedence(token.second) <= precedence(lastToken.second)) ||
-                           (!isLeftAssociative(token.first[0]) && precedence(token.second) < precedence(lastToken.second))) {
-                        
-                        handleOperator(opStack, outputStack);
+                    // Logical not, the only prefix delimiter
+                    if (token.text != "!") {
+                        unexpected(token);
                     }
                     
-                    // Skip the tokens that were part of the function identifier
-                    i += func.size() - 1;
-                    
-                    pushToOpStack(opStack, outputStack, token, lastToken);
-                    
-                    
-                    
+                    opStack.push(Token{TokenType::UnaryOperator, token.text, token.offset});
                     break;
                 }
-            }
-            
-            bool isConstant = false;
-            
-            // Check if the identifier is a constant
-            for (const auto& pair : m_constants) {
                 
-                isConstant = true;
+                if (!ConditionNode::fromSymbol(token.text)) {
+                    unexpected(token);
+                }
                 
-                // Compare the identifier with the constant name
-                for (int j = 0; j < pair.first.size(); ++j) {
-                    
-                    // Prevent out of bounds access
-                    if (j + i > m_tokens.size() - 1) {
-                        break;
-                    }
-                    
-                    // Compare the tokens with the constant name
-                    if (m_tokens[i + j].first[0] != pair.first[j]) {
-                        isConstant = false;
-                        break;
-                    }
+                pushToOpStack(opStack, outputStack, token);
+                expectOperand = true;
+                break;
+                
+            case TokenType::BracketOpen:
+                
+                if (!expectOperand) {
+                    unexpected(token);
                 }
                 
-                if (isConstant) {
-                    
-                    outputStack.push(std::make_unique<ConstantNode>(pair.second));
-                    
-                    lastToken = token;
-                    
-                    // Skip the tokens that were part of the constant identifier
-                    i += pair.first.size() - 1;
-                    
-                    break;
+                opStack.push(token);
+                argumentCounts.push(0);
+                break;
+                
+            case TokenType::Punctuation:
+                
+                // Argument separator, only valid directly inside the brackets of a call
+                if (expectOperand || argumentCounts.empty() || argumentCounts.top() == 0) {
+                    unexpected(token);
                 }
-            }
-
-            if (!isFunction && !isConstant) {
                 
-                // If the identifier is not a function or constant, treat it as a variable
-                if (lastToken.second == Tokenizer::TokenType::UnaryOperator && lastToken.first == "-") {
-                    
-                    outputStack.push(std::make_unique<VariableNode>(token.first, true));
-                    
-                } else {
-                    
-                    outputStack.push(std::make_unique<VariableNode>(token.first, false));
+                while (opStack.top().type != TokenType::BracketOpen) {
                     
+                    handleOperator(opStack, outputStack);
                 }
                 
-                lastToken = token;
+                argumentCounts.top()++;
+                expectOperand = true;
+                break;
                 
-            }
-
-        } else if (token.second == Tokenizer::TokenType::BracketOpen) {
-            
-            // Push the opening bracket to the operator stack
-            opStack.push(token);
-            
-            lastToken = token;
-            
-        } else if (token.second == Tokenizer::TokenType::BracketClose) {
-            
-            // Pop operators from the stack until an opening bracket is found
-            while (!opStack.empty() && opStack.top().second != Tokenizer::TokenType::BracketOpen) {
+            case TokenType::BracketClose:
                 
-                handleOperator(opStack, outputStack);
+                if (expectOperand) {
+                    unexpected(token);
+                }
                 
-            }
-            
-            opStack.pop();
-            token = opStack.top();
-            
-            if (!opStack.empty() && token.second == Tokenizer::TokenType::Function) {
+                // Pop operators from the stack until an opening bracket is found
+                while (!opStack.empty() && opStack.top().type != TokenType::BracketOpen) {
+                    
+                    handleOperator(opStack, outputStack);
+                }
                 
-                handleOperator(opStack, outputStack);
+                if (opStack.empty()) {
+                    throw std::runtime_error("Unmatched ')' at " + std::to_string(token.offset));
+                }
                 
-                lastToken = token;
+                opStack.pop();
                 
-            } else {
+                if (argumentCounts.top() > 0) {
+                    
+                    handleCall(opStack, outputStack, argumentCounts.top());
+                }
                 
-                lastToken = token;
-            }
-
+                argumentCounts.pop();
+                break;
+                
+            default:
+                
+                unexpected(token);
         }
     }
     
+    if (expectOperand) {
+        throw std::runtime_error("Unexpected end of expression");
+    }
+    
     while (!opStack.empty()) {
         
+        if (opStack.top().type == TokenType::BracketOpen) {
+            throw std::runtime_error("Unmatched '(' at " + std::to_string(opStack.top().offset));
+        }
+        
         handleOperator(opStack, outputStack);
     }
     
     isStackEmpty(outputStack);
     
-    auto node = std::move(outputStack.top());
+    ASTNode* node = outputStack.top();
     outputStack.pop();
     
     if (funcHeaderNode) {
         
-        funcHeaderNode->setBody(std::move(node));
-        
-        return std::move(funcHeaderNode);
+        funcHeaderNode->setBody(node);
+        funcHeaderNode->setVariables(arena.internAll(m_variables));
         
-    } else {
-        
-        return node;
+        return funcHeaderNode;
+    }
+    
+    return node;
+}
+
+const std::vector<std::string>& ShuntingYard::getVariables() const {
+    return m_variables;
+}
+
+std::size_t ShuntingYard::slot(std::string_view variable) {
+    
+    // The index of an enclosing series shadows everything else
+    for (auto it = m_indices.rbegin(); it != m_indices.rend(); ++it) {
+        if (it->first == variable) {
+            return it->second;
+        }
+    }
+    
+    for (std::size_t i = 0; i < m_variables.size(); ++i) {
+        if (m_variables[i] == variable) {
+            return i;
+        }
+    }
+    
+    if (m_variables.size() >= Context::capacity) {
+        throw std::runtime_error("Too many variables, at most " + std::to_string(Context::capacity) + " are supported");
+    }
+    
+    m_variables.emplace_back(variable);
+    
+    return m_variables.size() - 1;
+}
+
+std::size_t ShuntingYard::indexSlot(std::string_view variable) {
+    
+    if (m_variables.size() >= Context::capacity) {
+        throw std::runtime_error("Too many variables, at most " + std::to_string(Context::capacity) + " are supported");
     }
+    
+    std::string_view name = variable.substr(0, variable.find('#'));
+    m_variables.push_back(std::string(name) + "#" + std::to_string(m_variables.size()));
+    
+    return m_variables.size() - 1;
+}
 
-    return std::move(funcHeaderNode);
+bool ShuntingYard::isSeriesIndex(std::size_t i) const {
+    
+    if (i < 2 || m_tokens[i - 1].type != TokenType::BracketOpen || m_tokens[i - 2].type != TokenType::Identifier) {
+        return false;
+    }
+    
+    const Token* next = peek(i + 1);
+    auto builtin = findBuiltin(m_tokens[i - 2].text);
+    
+    return next && next->type == TokenType::Punctuation && (builtin == Builtin::Sum || builtin == Builtin::Product);
 }
 
-int ShuntingYard::precedence(Tokenizer::TokenType type) const {
-    switch (type) {
-        case Tokenizer::TokenType::BinaryPMOperator:
+int ShuntingYard::precedence(const Token& token) const {
+    switch (token.type) {
+        case TokenType::Delimiter:
+            
+            if (token.text == "||") {
+                return 1;
+            }
+            if (token.text == "&&") {
+                return 2;
+            }
+            return 3; // <, <=, >, >=, ==, !=
+            
+        case TokenType::BinaryPMOperator:
             
-            return 1; // +, -
+            return 4; // +, -
             
-        case Tokenizer::TokenType::BinaryMDOperator:
+        case TokenType::BinaryMDOperator:
             
-            return 2; // *, /
+            return 5; // *, /
             
-        case Tokenizer::TokenType::BinaryPowerOperator:
+        case TokenType::UnaryOperator:
             
-            return 3; // ^
+            return 6; // -x and !x, bind weaker than ^ so -x^2 is -(x^2)
             
-        case Tokenizer::TokenType::Function:
+        case TokenType::BinaryPowerOperator:
             
-            return 4; // Function calls
+            return 7; // ^
+            
+        case TokenType::Function:
+            
+            return 8; // Function calls
             
         default:
             
-            return 0; // Unknown or no precedence
+            return 0; // Brackets or no precedence
     }
 }
 
-bool ShuntingYard::isLeftAssociative(char op) const {
-    return op != '^';
+bool ShuntingYard::isLeftAssociative(const Token& token) const {
+    return token.type != TokenType::BinaryPowerOperator && token.type != TokenType::UnaryOperator;
 }
 
-void ShuntingYard::isStackEmpty(const std::stack<std::pair<std::string, Tokenizer::TokenType>>& stack) const {
+void ShuntingYard::isStackEmpty(const std::stack<Token>& stack) const {
     if(stack.empty()) {
         throw std::runtime_error("Stack is empty");
     }
 }
 
-void ShuntingYard::isStackEmpty(const std::stack<std::unique_ptr<ASTNode>>& stack) const {
+void ShuntingYard::isStackEmpty(const std::stack<ASTNode*>& stack) const {
     if(stack.empty()) {
         throw std::runtime_error("Stack is empty");
     }
 }
 
-std::unique_ptr<ASTNode> ShuntingYard::setupFuncHeader(const std::pair<std::string, Tokenizer::TokenType>& token) {
-    //Irgendwie besser machen
-    std::unique_ptr<ASTNode> header = std::make_unique<FunctionHeaderNode>(token.first, std::vector<std::string>());
-    return header;
+std::size_t ShuntingYard::parseFunctionHeader(FunctionHeaderNode*& header) {
+    
+    // name ( parameter, ... ) =
+    if (m_tokens.size() < 4 ||
+        m_tokens[0].type != TokenType::Identifier ||
+        m_tokens[1].type != TokenType::BracketOpen) {
+        
+        return 0;
+    }
+    
+    std::vector<std::string_view> parameters;
+    
+    std::size_t i = 2;
+    while (i < m_tokens.size() && m_tokens[i].type == TokenType::Identifier) {
+        
+        parameters.emplace_back(m_tokens[i].text);
+        i++;
+        
+        if (i < m_tokens.size() && m_tokens[i].type == TokenType::Punctuation) {
+            i++;
+        } else {
+            break;
+        }
+    }
+    
+    // Without the = it is a call like sin(x) at the start of a plain expression
+    if (i + 1 >= m_tokens.size() ||
+        m_tokens[i].type != TokenType::BracketClose ||
+        m_tokens[i + 1].text != "=") {
+        
+        return 0;
+    }
+    
+    header = m_arena->make<FunctionHeaderNode>(m_arena->intern(m_tokens[0].text), m_arena->internAll(parameters));
+    
+    // Parameters occupy the first slots in declaration order
+    for (const auto& parameter : parameters) {
+        slot(parameter);
+    }
+    
+    return i + 2;
+}
+
+bool ShuntingYard::parseIdentifier(std::size_t& i, std::stack<Token>& opStack, std::stack<ASTNode*>& outputStack) {
+    
+    const Token& token = m_tokens[i];
+    const Token* next = peek(i + 1);
+    
+    auto symbol = m_symbols.find(token.text);
+    
+    // Function call, the opening bracket is pushed with it
+    if (next && next->type == TokenType::BracketOpen) {
+        
+        if (!symbol || symbol->kind == SymbolTable::Kind::Constant) {
+            throw std::runtime_error("Function not found: " + std::string(token.text));
+        }
+        
+        opStack.push(Token{TokenType::Function, token.text, token.offset});
+        opStack.push(*next);
+        
+        i++;
+        return true;
+    }
+    
+    if (symbol && symbol->kind == SymbolTable::Kind::Constant) {
+        
+        outputStack.push(m_arena->make<ConstantNode>(symbol->value));
+        return false;
+    }
+    
+    if (symbol) {
+        unexpected(token);
+    }
+    
+    // Bound until the series is closed
+    if (isSeriesIndex(i)) {
+        
+        std::size_t index = indexSlot(token.text);
+        m_indices.emplace_back(token.text, index);
+        
+        outputStack.push(m_arena->make<VariableNode>(m_arena->intern(m_variables[index]), index));
+        return false;
+    }
+    
+    outputStack.push(m_arena->make<VariableNode>(m_arena->intern(token.text), slot(token.text)));
+    
+    return false;
 }
 
-void ShuntingYard::pushToOpStack(std::stack<std::pair<std::string, Tokenizer::TokenType>>& opStack,
-                                    std::stack<std::unique_ptr<ASTNode>>& outputStack,
-                                    const std::pair<std::string, Tokenizer::TokenType>& token,
-                                 std::pair<std::string, Tokenizer::TokenType>& lastToken) {
+void ShuntingYard::pushToOpStack(std::stack<Token>& opStack, std::stack<ASTNode*>& outputStack, const Token& token) {
     
     while (!opStack.empty() &&
-           ((isLeftAssociative(token.first[0]) && precedence(opStack.top().second) >= precedence(token.second)) ||
-            (!isLeftAssociative(token.first[0]) && precedence(opStack.top().second) > precedence(token.second)))) {
+           (precedence(opStack.top()) > precedence(token) ||
+            (precedence(opStack.top()) == precedence(token) && isLeftAssociative(token)))) {
         
         handleOperator(opStack, outputStack);
     }
     
     opStack.push(token);
-    lastToken = token;
 }
 
-void ShuntingYard::handleOperator(std::stack<std::pair<std::string, Tokenizer::TokenType>>& opStack,
-                                    std::stack<std::unique_ptr<ASTNode>>& outputStack) {
+void ShuntingYard::handleOperator(std::stack<Token>& opStack, std::stack<ASTNode*>& outputStack) {
     
     isStackEmpty(opStack);
     
-    auto op = opStack.top();
+    Token op = opStack.top();
     opStack.pop();
     
-    if (op.second == Tokenizer::TokenType::FunctionHeader) {
+    if (op.type == TokenType::BinaryPMOperator ||
+        op.type == TokenType::BinaryMDOperator ||
+        op.type == TokenType::BinaryPowerOperator) {
         
         isStackEmpty(outputStack);
         
-        outputStack.push(setupFuncHeader(op));
-        
-    } else if (op.second == Tokenizer::TokenType::BinaryPMOperator ||
-               op.second == Tokenizer::TokenType::BinaryMDOperator ||
-               op.second == Tokenizer::TokenType::BinaryPowerOperator) {
+        ASTNode* right = outputStack.top();
+        outputStack.pop();
         
         isStackEmpty(outputStack);
         
-        auto right = std::move(outputStack.top());
+        ASTNode* left = outputStack.top();
         outputStack.pop();
         
-        isStackEmpty(outputStack);
+        outputStack.push(m_arena->make<BinaryOperationNode>(left, right, op.text[0]));
         
-        auto left = std::move(outputStack.top());
-        outputStack.pop();
+    } else if (op.type == TokenType::Delimiter) {
         
-        outputStack.push(std::make_unique<BinaryOperationNode>(std::move(left), std::move(right), op.first[0]));
+        isStackEmpty(outputStack);
         
-    } else if (op.second == Tokenizer::TokenType::UnaryOperator) {
+        ASTNode* right = outputStack.top();
+        outputStack.pop();
         
         isStackEmpty(outputStack);
-        auto arg = std::move(outputStack.top());
+        
+        ASTNode* left = outputStack.top();
         outputStack.pop();
         
-        outputStack.push(std::make_unique<NegationNode>(std::move(arg)));
-    
-    } else if (op.second == Tokenizer::TokenType::Function) {
+        outputStack.push(m_arena->make<ConditionNode>(left, right, *ConditionNode::fromSymbol(op.text)));
+        
+    } else if (op.type == TokenType::UnaryOperator) {
         
         isStackEmpty(outputStack);
         
-        auto arg = std::move(outputStack.top());
+        ASTNode* arg = outputStack.top();
         outputStack.pop();
         
-        outputStack.push(std::make_unique<FunctionNode>(op.first, std::move(arg)));
+        // !x is x == 0
+        if (op.text == "!") {
+            outputStack.push(m_arena->make<ConditionNode>(arg, m_arena->make<ConstantNode>(0.0), Condition::Equal));
+        } else {
+            outputStack.push(m_arena->make<NegationNode>(arg));
+        }
+    
+    } else {
         
-    } else if (op.second == Tokenizer::TokenType::BracketClose) {
+        unexpected(op);
+    }
+}
+
+void ShuntingYard::handleCall(std::stack<Token>& opStack, std::stack<ASTNode*>& outputStack, std::size_t argumentCount) {
+    
+    Token call = opStack.top();
+    opStack.pop();
+    
+    auto symbol = m_symbols.find(call.text);
+    if (!symbol || symbol->kind == SymbolTable::Kind::Constant) {
+        throw std::runtime_error("Function not found: " + std::string(call.text));
+    }
+    
+    if (symbol->kind == SymbolTable::Kind::UserFunction) {
         
-        while (!opStack.empty() && opStack.top().second != Tokenizer::TokenType::BracketOpen) {
-            
-            handleOperator(opStack, outputStack);
+        if (argumentCount > Context::capacity) {
+            throw std::runtime_error("Too many arguments for " + std::string(call.text) + " at " + std::to_string(call.offset));
         }
         
-    } else if (op.second == Tokenizer::TokenType::BracketOpen) {
+        std::array<ASTNode*, Context::capacity> arguments{};
         
-        if (!opStack.empty() && opStack.top().second == Tokenizer::TokenType::Function) {
+        for (std::size_t i = argumentCount; i-- > 0;) {
             
-            handleOperator(opStack, outputStack);
+            isStackEmpty(outputStack);
             
+            arguments[i] = outputStack.top();
+            outputStack.pop();
         }
         
-    } else {
+        outputStack.push(callFunction(call, symbol->function, std::span(arguments).first(argumentCount)));
+        return;
+    }
+    
+    std::size_t arity = builtinInfo(symbol->builtin).arity;
+    
+    if (argumentCount != arity) {
+        throw std::runtime_error("Function " + std::string(call.text) + " expects " + std::to_string(arity) +
+                                 " argument" + (arity == 1 ? "" : "s") + ", got " + std::to_string(argumentCount) +
+                                 " at " + std::to_string(call.offset));
+    }
+    
+    // Arguments are on the output stack in order, the last one on top
+    std::array<ASTNode*, maxBuiltinArity> arguments{};
+    
+    for (std::size_t i = arity; i-- > 0;) {
         
-        throw std::runtime_error("Unknown operator " + op.first + " type in stack");
+        isStackEmpty(outputStack);
+        
+        arguments[i] = outputStack.top();
+        outputStack.pop();
     }
+    
+    if (arity == 4) {
+        
+        auto* index = dynamic_cast<VariableNode*>(arguments[0]);
+        
+        if (!index || m_indices.empty() || m_indices.back().second != index->m_slot) {
+            throw std::runtime_error("Function " + std::string(call.text) + " expects an index variable as first argument at " +
+                                     std::to_string(call.offset));
+        }
+        
+        m_indices.pop_back();
+        
+        outputStack.push(m_arena->make<SeriesNode>(symbol->builtin, index, arguments[1], arguments[2], arguments[3]));
+        return;
+    }
+    
+    switch (arity) {
+        case 1:
+            outputStack.push(m_arena->make<FunctionNode>(symbol->builtin, arguments[0]));
+            break;
+        case 2:
+            outputStack.push(m_arena->make<BinaryCallNode>(symbol->builtin, std::array{arguments[0], arguments[1]}));
+            break;
+        default:
+            outputStack.push(m_arena->make<TernaryCallNode>(symbol->builtin, std::array{arguments[0], arguments[1], arguments[2]}));
+            break;
+    }
+}
+
+ASTNode* ShuntingYard::callFunction(const Token& call, const std::shared_ptr<const CompiledExpression>& function, std::span<ASTNode* const> given) {
+    
+    const FunctionHeaderNode& header = *function->header;
+    
+    if (m_header && m_header->name == call.text) {
+        throw std::runtime_error("Function " + std::string(call.text) + " can not call itself at " + std::to_string(call.offset));
+    }
+    
+    std::size_t parameterCount = header.getParameterCount();
+    
+    if (given.size() > parameterCount) {
+        throw std::runtime_error("Function " + std::string(call.text) + " expects " + std::to_string(parameterCount) +
+                                 " argument" + (parameterCount == 1 ? "" : "s") + ", got " + std::to_string(given.size()) +
+                                 " at " + std::to_string(call.offset));
+    }
+    
+    // One argument per slot of the callee, the rest of its slot table becomes variables of the caller
+    std::array<ASTNode*, Context::capacity> arguments{};
+    std::copy(given.begin(), given.end(), arguments.begin());
+    
+    for (std::size_t i = given.size(); i < header.variables.size(); ++i) {
+        
+        // Indices of series in the callee get fresh slots, so they can not capture a variable of the caller
+        std::string_view name = header.variables[i];
+        std::size_t variable = name.find('#') == std::string_view::npos ? slot(name) : indexSlot(name);
+        
+        arguments[i] = m_arena->make<VariableNode>(m_arena->intern(m_variables[variable]), variable);
+    }
+    
+    std::span<ASTNode* const> slots = std::span(arguments).first(header.variables.size());
+    
+    if (std::find(m_dependencies.begin(), m_dependencies.end(), function) == m_dependencies.end()) {
+        m_dependencies.push_back(function);
+    }
+    
+    // Stored and static functions parse their body on first use, it has the same slot table as the header
+    const FunctionHeaderNode* tree = function->tree();
+    
+    if (tree && function->program.size() <= m_maxInlineSize) {
+        return tree->body->substitute(*m_arena, slots);
+    }
+    
+    // Calls keep the tree as well, so they can be differentiated
+    return m_arena->make<InvokeNode>(tree ? tree : &header, &function->program, m_arena->copy(slots));
+}
+
+const Tokenizer::Token* ShuntingYard::peek(std::size_t i) const {
+    return i < m_tokens.size() ? &m_tokens[i] : nullptr;
+}
+
+void ShuntingYard::unexpected(const Token& token) const {
+    throw std::runtime_error("Unexpected '" + std::string(token.text) + "' at " + std::to_string(token.offset));
 }
@@ -8,66 +8,123 @@
 #ifndef PARSER_HPP
 #define PARSER_HPP
 
+#include <memory>
+#include <span>
 #include <stack>
+#include <string_view>
+#include <vector>
 
 #include "Tokenizer.hpp"
 #include "AST.hpp"
+#include "Optimizer.hpp"
+#include "Symbols.hpp"
 
 
 
 class ShuntingYard {
 public:
+    using Token = Tokenizer::Token;
+    using TokenType = Tokenizer::TokenType;
+
     ShuntingYard() = default;
     
-    void setTokens(const std::vector<std::pair<std::string, Tokenizer::TokenType>>& tokens);
+    // The tokens are not copied, they have to outlive the call to parse
+    void setTokens(std::span<const Token> tokens);
+    
+    // Nodes and names are allocated in the given arena
+    ASTNode* parse(Arena& arena);
+    
+    // Slot table of the last parse, index is the slot of the variable
+    const std::vector<std::string>& getVariables() const;
     
-    std::unique_ptr<ASTNode> parse();
+    SymbolTable& getSymbols() { return m_symbols; }
+    
+    // User functions called by the last parse, in the order of their first call
+    const std::vector<std::shared_ptr<const CompiledExpression>>& getDependencies() const { return m_dependencies; }
     
 private:
-    int precedence(Tokenizer::TokenType type) const;
+    std::size_t slot(std::string_view variable);
+    
+    // New slot for the index of a series, named "k#slot" so indices of different series never share one
+    std::size_t indexSlot(std::string_view variable);
+    
+    // The identifier at i is the first argument of sum( or prod(
+    bool isSeriesIndex(std::size_t i) const;
+    
+    int precedence(const Token& token) const;
+    bool isLeftAssociative(const Token& token) const;
+    
+    void isStackEmpty(const std::stack<Token>& stack) const;
+    void isStackEmpty(const std::stack<ASTNode*>& stack) const;
+    
+    // Parses "name(parameters) =" at the front and returns the index of the first body token
+    std::size_t parseFunctionHeader(FunctionHeaderNode*& header);
+    
+    // Returns true for a function call, i is then moved past its opening bracket
+    bool parseIdentifier(std::size_t& i, std::stack<Token>& opStack, std::stack<ASTNode*>& outputStack);
+    
+    void pushToOpStack(std::stack<Token>& opStack, std::stack<ASTNode*>& outputStack, const Token& token);
     
-    bool isLeftAssociative(char op) const;
-    void isStackEmpty(const std::stack<std::pair<std::string, Tokenizer::TokenType>>& stack) const;
-    void isStackEmpty(const std::stack<std::unique_ptr<ASTNode>>& stack) const;
+    void handleOperator(std::stack<Token>& opStack, std::stack<ASTNode*>& outputStack);
     
-    std::unique_ptr<ASTNode> setupFuncHeader(const std::pair<std::string, Tokenizer::TokenType>& token);
+    // Pops the function below a closed call bracket and its arguments from the output
+    void handleCall(std::stack<Token>& opStack, std::stack<ASTNode*>& outputStack, std::size_t argumentCount);
     
-    void pushToOpStack(std::stack<std::pair<std::string, Tokenizer::TokenType>>& opStack,
-                       std::stack<std::unique_ptr<ASTNode>>& outputStack,
-                       const std::pair<std::string, Tokenizer::TokenType>& token,
-                       std::pair<std::string, Tokenizer::TokenType>& lastToken);
+    // Inlines the body of a small callee or invokes its program. Parameters left out at the end
+    // are passed as the caller's variables of the same name, like the free variables of the callee
+    ASTNode* callFunction(const Token& call, const std::shared_ptr<const CompiledExpression>& function, std::span<ASTNode* const> given);
     
-    void handleOperator(std::stack<std::pair<std::string, Tokenizer::TokenType>>& opStack,
-                        std::stack<std::unique_ptr<ASTNode>>& outputStack);
+    const Token* peek(std::size_t i) const;
+    
+    [[noreturn]] void unexpected(const Token& token) const;
     
 private:
-    std::vector<std::pair<std::string, Tokenizer::TokenType>> m_tokens;
+    std::span<const Token> m_tokens;
+    std::vector<std::string> m_variables;
+    
+    // Arena of the current parse
+    Arena* m_arena = nullptr;
+    
+    // Header of the function being defined, a function can not call itself
+    const FunctionHeaderNode* m_header = nullptr;
     
-    const std::vector<std::string> m_functions = {"sin", "cos", "tan", "exp", "log", "sqrt", "abs", "pow", "min", "max"};
-    const std::unordered_map<std::string, double> m_constants = {
-        {"pi", M_PI},
-        {"e", M_E}
-    };
+    // Indices of the series being parsed with their slots, innermost last
+    std::vector<std::pair<std::string_view, std::size_t>> m_indices;
+    
+    SymbolTable m_symbols;
+    std::vector<std::shared_ptr<const CompiledExpression>> m_dependencies;
+    
+    // Callees with at most this many instructions are inlined, so the optimizer sees across the call
+    static constexpr std::size_t m_maxInlineSize = 64;
 };
 
 
 
 class Parser {
 public:
-    Parser();
+    Parser() = default;
 
     void setExpression(const std::string& expression);
 
-    std::unique_ptr<ASTNode> parse();
+    // Optimized tree in its own arena, packed in evaluation order
+    Expression parse();
+    
+    const std::vector<std::string>& getVariables() const;
+    
+    // Constants and function aliases registered here are known to every following parse
+    SymbolTable& getSymbols() { return m_shuntingYard.getSymbols(); }
+    
+    const std::vector<std::shared_ptr<const CompiledExpression>>& getDependencies() const { return m_shuntingYard.getDependencies(); }
 
 private:
     std::string m_expression;
 
-    std::vector<std::pair<std::string, Tokenizer::TokenType>> m_tokens;
-
     Tokenizer m_tokenizer;
     ShuntingYard m_shuntingYard;
+    Optimizer m_optimizer;
+    
+    // Parsing and optimizing happen here, only the final tree is copied out of it
+    Arena m_scratch;
 };
 
-
 #endif
@@ -0,0 +1,97 @@
+//
+//  PerfectHash.hpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#ifndef PERFECT_HASH_HPP
+#define PERFECT_HASH_HPP
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+
+
+/// @class PerfectHash
+/// @brief Collision free hash over a fixed set of names, built at compile time.
+/// The constructor searches a seed for which every key lands in its own slot, a lookup is
+/// then one hash and one string compare regardless of the number of keys. Empty keys are skipped.
+template<std::size_t N>
+class PerfectHash {
+public:
+    // Load factor of at most one half keeps the seed search short
+    static constexpr std::size_t size = std::bit_ceil(N * 2);
+
+public:
+    constexpr explicit PerfectHash(const std::array<std::string_view, N>& keys) : m_keys(keys) {
+
+        for (m_seed = 1; m_seed < m_maxSeed; ++m_seed) {
+            if (tryBuild()) {
+                return;
+            }
+        }
+
+        // Only reachable with duplicate keys, fails the constant evaluation
+        throw std::logic_error("No perfect hash found");
+    }
+
+    // Index of the key in the array the table was built from
+    constexpr std::optional<std::size_t> find(std::string_view key) const {
+        std::int32_t index = m_slots[hash(key, m_seed) & (size - 1)];
+
+        if (index < 0 || m_keys[index] != key) {
+            return std::nullopt;
+        }
+
+        return static_cast<std::size_t>(index);
+    }
+
+private:
+    constexpr bool tryBuild() {
+        m_slots.fill(-1);
+
+        for (std::size_t i = 0; i < N; ++i) {
+
+            // Empty keys keep their index but are never found
+            if (m_keys[i].empty()) {
+                continue;
+            }
+
+            std::int32_t& slot = m_slots[hash(m_keys[i], m_seed) & (size - 1)];
+
+            if (slot >= 0) {
+                return false;
+            }
+
+            slot = static_cast<std::int32_t>(i);
+        }
+
+        return true;
+    }
+
+    static constexpr std::uint64_t hash(std::string_view key, std::uint64_t seed) {
+
+        // FNV-1a with the seed mixed into the offset basis
+        std::uint64_t hash = 0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+
+        for (char c : key) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 0x100000001b3ULL;
+        }
+
+        return hash ^ (hash >> 29);
+    }
+
+private:
+    static constexpr std::uint64_t m_maxSeed = 1 << 16;
+
+    std::array<std::string_view, N> m_keys;
+    std::array<std::int32_t, size> m_slots{};
+    std::uint64_t m_seed = 0;
+};
+
+#endif // PERFECT_HASH_HPP
@@ -0,0 +1,1232 @@
+//
+//  Program.cpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#include "Program.hpp"
+
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+#include <bit>
+#include <numbers>
+#include <optional>
+
+
+namespace {
+
+    // Bounds from inf - inf or 0 * inf are nan, nothing is known about the result then
+    Interval bounds(double lo, double hi, bool continuous) {
+        if (std::isnan(lo) || std::isnan(hi)) {
+            return Interval::whole();
+        }
+        return {lo, hi, continuous};
+    }
+
+    Interval multiply(Interval a, Interval b) {
+        double products[] = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+
+        if (std::any_of(std::begin(products), std::end(products), [](double p) { return std::isnan(p); })) {
+            return Interval::whole();
+        }
+
+        auto [lo, hi] = std::minmax_element(std::begin(products), std::end(products));
+        return {*lo, *hi, a.continuous && b.continuous};
+    }
+
+    double magnitudeLow(Interval a) {
+        return a.contains(0) ? 0.0 : std::min(std::abs(a.lo), std::abs(a.hi));
+    }
+
+    double magnitudeHigh(Interval a) {
+        return std::max(std::abs(a.lo), std::abs(a.hi));
+    }
+
+    // Some offset + k * period lies inside a
+    bool containsPeriodic(Interval a, double offset, double period) {
+        return std::ceil((a.lo - offset) / period) <= std::floor((a.hi - offset) / period);
+    }
+
+    Interval divide(Interval a, Interval b) {
+        bool continuous = a.continuous && b.continuous;
+
+        // Division by zero is defined as 0, like in the scalar evaluator
+        if (b.lo == 0 && b.hi == 0) {
+            return {0.0, 0.0, continuous};
+        }
+        // Pole, or at least the jump to 0 where the divisor vanishes
+        if (b.contains(0)) {
+            return Interval::whole();
+        }
+        return multiply(a, {1.0 / b.hi, 1.0 / b.lo, continuous});
+    }
+
+    Interval power(Interval a, Interval b) {
+        bool continuous = a.continuous && b.continuous;
+
+        // Integer exponent, x^n is monotone on both sides of 0
+        if (b.lo == b.hi && b.lo == std::round(b.lo)) {
+            double n = b.lo;
+
+            if (n == 0) {
+                return {1.0, 1.0, continuous};
+            }
+            if (n < 0 && a.contains(0)) {
+                return Interval::whole();
+            }
+
+            double lo = std::pow(a.lo, n);
+            double hi = std::pow(a.hi, n);
+
+            // Even powers fall to 0 and rise again
+            if (std::fmod(n, 2.0) == 0 && a.contains(0)) {
+                return bounds(0.0, std::max(lo, hi), continuous);
+            }
+            return bounds(std::min(lo, hi), std::max(lo, hi), continuous);
+        }
+
+        // Positive base, a^b is monotone in both operands and the extremes are corners
+        if (a.lo > 0 || (a.lo == 0 && b.lo > 0)) {
+            double corners[] = {std::pow(a.lo, b.lo), std::pow(a.lo, b.hi), std::pow(a.hi, b.lo), std::pow(a.hi, b.hi)};
+
+            auto [lo, hi] = std::minmax_element(std::begin(corners), std::end(corners));
+            return bounds(*lo, *hi, continuous);
+        }
+
+        // Negative base with a fractional exponent is undefined
+        return Interval::whole();
+    }
+
+    Interval sine(Interval a) {
+        if (!a.bounded() || a.width() >= 2 * std::numbers::pi) {
+            return {-1.0, 1.0, a.continuous};
+        }
+
+        double lo = std::min(std::sin(a.lo), std::sin(a.hi));
+        double hi = std::max(std::sin(a.lo), std::sin(a.hi));
+
+        // Extremes inside the range lie at pi/2 and 3pi/2 modulo 2pi
+        if (containsPeriodic(a, std::numbers::pi / 2, 2 * std::numbers::pi)) {
+            hi = 1.0;
+        }
+        if (containsPeriodic(a, 3 * std::numbers::pi / 2, 2 * std::numbers::pi)) {
+            lo = -1.0;
+        }
+        return {lo, hi, a.continuous};
+    }
+
+    Interval tangent(Interval a) {
+        // Every range containing pi/2 + k pi has a pole
+        if (!a.bounded() || a.width() >= std::numbers::pi || containsPeriodic(a, std::numbers::pi / 2, std::numbers::pi)) {
+            return Interval::whole();
+        }
+        return {std::tan(a.lo), std::tan(a.hi), a.continuous};
+    }
+
+    Interval arcTangent2(Interval y, Interval x) {
+        bool continuous = y.continuous && x.continuous;
+
+        // Right half plane, monotone in both operands
+        if (x.lo > 0) {
+            double corners[] = {std::atan2(y.lo, x.lo), std::atan2(y.lo, x.hi), std::atan2(y.hi, x.lo), std::atan2(y.hi, x.hi)};
+
+            auto [lo, hi] = std::minmax_element(std::begin(corners), std::end(corners));
+            return bounds(*lo, *hi, continuous);
+        }
+        if (y.lo > 0) {
+            return {0.0, std::numbers::pi, continuous};
+        }
+        if (y.hi < 0) {
+            return {-std::numbers::pi, 0.0, continuous};
+        }
+
+        // May cross the cut along the negative x axis
+        return {-std::numbers::pi, std::numbers::pi, false};
+    }
+
+    // Truth value on the whole range, empty if it changes inside
+    std::optional<bool> truth(Interval a) {
+        if (!a.contains(0)) {
+            return true;
+        }
+        if (a.lo == 0 && a.hi == 0) {
+            return false;
+        }
+        return std::nullopt;
+    }
+
+    Interval condition(std::optional<bool> value) {
+        if (!value) {
+            return {0.0, 1.0, false};
+        }
+        return Interval::point(*value ? 1.0 : 0.0);
+    }
+}
+
+
+void Program::finish(std::uint32_t result) {
+
+    if (m_instructions.empty()) {
+        emitConstant(0.0);
+    } else if (result + 1 != m_instructions.size()) {
+
+        // E.g. a call whose result was already computed by the caller, copied without interning.
+        // A loop instruction can not be repeated on its own, max(r, r) is r
+        Instruction copy = m_instructions[result];
+
+        if (copy.op == OpCode::Counter || isReduction(copy.op)) {
+            copy = {OpCode::Max, result, result};
+        }
+
+        m_instructions.push_back(copy);
+    }
+
+    m_registers.clear();
+}
+
+void Program::load(std::vector<Instruction> instructions) {
+
+    // Operands have to refer to earlier registers, otherwise execute would read garbage
+    std::vector<std::uint32_t> loops;
+
+    for (std::size_t i = 0; i < instructions.size(); ++i) {
+
+        const Instruction& in = instructions[i];
+
+        if (static_cast<std::size_t>(in.op) >= opCodeCount) {
+            throw std::runtime_error("Invalid opcode in program");
+        }
+
+        bool valid = true;
+
+        if (in.op == OpCode::Variable) {
+            valid = in.a < Context::capacity;
+        } else if (in.op == OpCode::Counter) {
+            loops.push_back(static_cast<std::uint32_t>(i));
+        } else if (isReduction(in.op)) {
+            // Closes the innermost open loop, which must not run forever
+            valid = !loops.empty() && loops.back() == in.a && in.b < i &&
+                    instructions[in.a].value <= in.value && in.value - instructions[in.a].value < (1 << 20);
+
+            if (valid) {
+                loops.pop_back();
+            }
+        } else if (in.op != OpCode::Constant) {
+            valid = in.a < i && (!isBinary(in.op) || in.b < i) && (!isTernary(in.op) || (in.b < i && in.c < i));
+        }
+
+        if (!valid) {
+            throw std::runtime_error("Invalid operand in program");
+        }
+    }
+
+    if (!loops.empty()) {
+        throw std::runtime_error("Unterminated loop in program");
+    }
+
+    m_instructions = std::move(instructions);
+    m_registers.clear();
+}
+
+std::uint32_t Program::emit(OpCode op, std::uint32_t a, std::uint32_t b, std::uint32_t c) {
+
+    // a + b and b + a share a register
+    if (isCommutative(op) && b < a) {
+        std::swap(a, b);
+    }
+
+    return intern({op, a, b, c, 0.0});
+}
+
+std::uint32_t Program::emitConstant(double value) {
+    return intern({OpCode::Constant, 0, 0, 0, value});
+}
+
+std::uint32_t Program::emitVariable(std::size_t slot) {
+
+    if (slot >= Context::capacity) {
+        throw std::runtime_error("Variable slot out of range");
+    }
+
+    for (auto it = m_bound.rbegin(); it != m_bound.rend(); ++it) {
+        if (it->first == slot) {
+            return it->second;
+        }
+    }
+
+    return intern({OpCode::Variable, static_cast<std::uint32_t>(slot), 0, 0, 0.0});
+}
+
+std::uint32_t Program::emitSeries(OpCode reduction, std::size_t slot, double first, double last, const ASTNode& term) {
+
+    std::uint32_t counter = append({OpCode::Counter, 0, 0, 0, first});
+
+    m_bound.emplace_back(slot, counter);
+    std::uint32_t result = term.compile(*this);
+    m_bound.pop_back();
+
+    return append({reduction, counter, result, 0, last});
+}
+
+std::uint32_t Program::append(const Instruction& instruction) {
+    m_instructions.push_back(instruction);
+
+    return static_cast<std::uint32_t>(m_instructions.size() - 1);
+}
+
+std::uint32_t Program::intern(const Instruction& instruction) {
+
+    auto [it, inserted] = m_registers.try_emplace(instruction, static_cast<std::uint32_t>(m_instructions.size()));
+
+    if (inserted) {
+        m_instructions.push_back(instruction);
+    }
+
+    return it->second;
+}
+
+bool Program::isCommutative(OpCode op) {
+    return op == OpCode::Add || op == OpCode::Multiply;
+}
+
+bool Program::isBinary(OpCode op) {
+    switch (op) {
+        case OpCode::Add:
+        case OpCode::Subtract:
+        case OpCode::Multiply:
+        case OpCode::Divide:
+        case OpCode::Power:
+        case OpCode::Min:
+        case OpCode::Max:
+        case OpCode::Atan2:
+        case OpCode::Hypot:
+        case OpCode::Less:
+        case OpCode::LessEqual:
+        case OpCode::Equal:
+        case OpCode::NotEqual:
+        case OpCode::And:
+        case OpCode::Or:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool Program::isTernary(OpCode op) {
+    return op == OpCode::Select;
+}
+
+bool Program::isReduction(OpCode op) {
+    return op == OpCode::Sum || op == OpCode::Product;
+}
+
+bool Program::isCondition(OpCode op) {
+    switch (op) {
+        case OpCode::Less:
+        case OpCode::LessEqual:
+        case OpCode::Equal:
+        case OpCode::NotEqual:
+        case OpCode::And:
+        case OpCode::Or:
+        case OpCode::Select:
+            return true;
+        default:
+            return false;
+    }
+}
+
+std::size_t Program::InstructionHash::operator()(const Instruction& instruction) const {
+    std::size_t hash = static_cast<std::size_t>(instruction.op);
+
+    hash = hash * 31 + instruction.a;
+    hash = hash * 31 + instruction.b;
+    hash = hash * 31 + instruction.c;
+    hash = hash * 31 + std::hash<std::uint64_t>{}(std::bit_cast<std::uint64_t>(instruction.value));
+
+    return hash;
+}
+
+bool Program::InstructionEqual::operator()(const Instruction& lhs, const Instruction& rhs) const {
+    // Constants are compared bitwise, so 0.0 and -0.0 stay apart
+    return lhs.op == rhs.op && lhs.a == rhs.a && lhs.b == rhs.b && lhs.c == rhs.c &&
+           std::bit_cast<std::uint64_t>(lhs.value) == std::bit_cast<std::uint64_t>(rhs.value);
+}
+
+std::uint32_t Program::splice(const Program& callee, std::span<const std::uint32_t> slots) {
+
+    if (callee.m_instructions.empty()) {
+        return emitConstant(0.0);
+    }
+
+    std::vector<std::uint32_t> registers(callee.m_instructions.size());
+
+    for (std::size_t i = 0; i < callee.m_instructions.size(); ++i) {
+
+        const Instruction& in = callee.m_instructions[i];
+
+        if (in.op == OpCode::Constant) {
+            registers[i] = emitConstant(in.value);
+        } else if (in.op == OpCode::Variable) {
+
+            if (in.a >= slots.size()) {
+                throw std::runtime_error("Missing argument for spliced program");
+            }
+
+            registers[i] = slots[in.a];
+        } else if (in.op == OpCode::Counter) {
+            registers[i] = append(in);
+        } else if (isReduction(in.op)) {
+            registers[i] = append({in.op, registers[in.a], registers[in.b], 0, in.value});
+        } else if (isTernary(in.op)) {
+            registers[i] = emit(in.op, registers[in.a], registers[in.b], registers[in.c]);
+        } else if (isBinary(in.op)) {
+            registers[i] = emit(in.op, registers[in.a], registers[in.b]);
+        } else {
+            registers[i] = emit(in.op, registers[in.a]);
+        }
+    }
+
+    return registers.back();
+}
+
+Program::OpCode Program::opCode(Builtin builtin) {
+    switch (builtin) {
+        case Builtin::Sin:
+            return OpCode::Sin;
+        case Builtin::Cos:
+            return OpCode::Cos;
+        case Builtin::Tan:
+            return OpCode::Tan;
+        case Builtin::Sqrt:
+            return OpCode::Sqrt;
+        case Builtin::Exp:
+            return OpCode::Exp;
+        case Builtin::Log:
+            return OpCode::Log;
+        case Builtin::Abs:
+            return OpCode::Abs;
+        case Builtin::Root:
+            return OpCode::Root;
+        case Builtin::Pow:
+            return OpCode::Power;
+        case Builtin::Min:
+            return OpCode::Min;
+        case Builtin::Max:
+            return OpCode::Max;
+        case Builtin::Atan2:
+            return OpCode::Atan2;
+        case Builtin::Hypot:
+            return OpCode::Hypot;
+        default:
+            throw std::runtime_error("Unknown builtin");
+    }
+}
+
+double Program::evaluate(const Context& context) const {
+
+    if (m_instructions.empty()) {
+        return 0.0;
+    }
+
+    // Register file is reused between calls, every worker thread owns its own
+    thread_local std::vector<double> registers;
+
+    if (registers.size() < m_instructions.size()) {
+        registers.resize(m_instructions.size());
+    }
+
+    execute(context, registers.data());
+
+    return registers[m_instructions.size() - 1];
+}
+
+Dual Program::evaluateDual(const Context& context, std::size_t slot) const {
+
+    Dual result;
+    result.value = evaluateGradient(context, std::span<const std::size_t>(&slot, 1), std::span<double>(&result.derivative, 1));
+
+    return result;
+}
+
+double Program::evaluateGradient(const Context& context, std::span<const std::size_t> slots, std::span<double> gradient) const {
+
+    if (gradient.size() < slots.size()) {
+        throw std::invalid_argument("Gradient is smaller than the number of slots");
+    }
+
+    if (m_instructions.empty()) {
+        std::fill(gradient.begin(), gradient.end(), 0.0);
+        return 0.0;
+    }
+
+    thread_local std::vector<double> registers;
+    thread_local std::vector<double> tangents;
+
+    if (registers.size() < m_instructions.size()) {
+        registers.resize(m_instructions.size());
+    }
+    if (tangents.size() < m_instructions.size() * slots.size()) {
+        tangents.resize(m_instructions.size() * slots.size());
+    }
+
+    executeTangents(context, slots, registers.data(), tangents.data());
+
+    std::size_t last = m_instructions.size() - 1;
+    std::copy_n(tangents.data() + last * slots.size(), slots.size(), gradient.begin());
+
+    return registers[last];
+}
+
+Interval Program::evaluateInterval(const Context& context, std::size_t slot, Interval x) const {
+
+    if (m_instructions.empty()) {
+        return Interval::point(0.0);
+    }
+
+    thread_local std::vector<Interval> registers;
+
+    if (registers.size() < m_instructions.size()) {
+        registers.resize(m_instructions.size());
+    }
+
+    Interval* r = registers.data();
+
+    for (std::size_t i = 0; i < m_instructions.size(); ++i) {
+
+        const Instruction& in = m_instructions[i];
+        Interval a = r[in.a];
+        Interval b = r[in.b];
+        bool continuous = a.continuous && b.continuous;
+
+        switch (in.op) {
+            case OpCode::Constant:
+                r[i] = Interval::point(in.value);
+                break;
+            case OpCode::Variable:
+                r[i] = in.a == slot ? x : Interval::point(context[in.a]);
+                break;
+            case OpCode::Add:
+                r[i] = bounds(a.lo + b.lo, a.hi + b.hi, continuous);
+                break;
+            case OpCode::Subtract:
+                // A register minus itself is 0 and not [lo - hi, hi - lo]
+                r[i] = in.a == in.b && a.bounded() ? Interval::point(0.0) : bounds(a.lo - b.hi, a.hi - b.lo, continuous);
+                break;
+            case OpCode::Multiply:
+                // Same for a square, it is never negative
+                if (in.a == in.b) {
+                    r[i] = power(a, Interval::point(2.0));
+                } else {
+                    r[i] = multiply(a, b);
+                }
+                break;
+            case OpCode::Divide:
+                r[i] = divide(a, b);
+                break;
+            case OpCode::Power:
+                r[i] = power(a, b);
+                break;
+            case OpCode::Min:
+                r[i] = {std::min(a.lo, b.lo), std::min(a.hi, b.hi), continuous};
+                break;
+            case OpCode::Max:
+                r[i] = {std::max(a.lo, b.lo), std::max(a.hi, b.hi), continuous};
+                break;
+            case OpCode::Atan2:
+                r[i] = arcTangent2(a, b);
+                break;
+            case OpCode::Hypot:
+                r[i] = {std::hypot(magnitudeLow(a), magnitudeLow(b)), std::hypot(magnitudeHigh(a), magnitudeHigh(b)), continuous};
+                break;
+            case OpCode::Less:
+                r[i] = condition(a.hi < b.lo ? std::optional(true) : a.lo >= b.hi ? std::optional(false) : std::nullopt);
+                break;
+            case OpCode::LessEqual:
+                r[i] = condition(a.hi <= b.lo ? std::optional(true) : a.lo > b.hi ? std::optional(false) : std::nullopt);
+                break;
+            case OpCode::Equal:
+            case OpCode::NotEqual: {
+                std::optional<bool> equal;
+
+                if (a.lo == a.hi && b.lo == b.hi && a.lo == b.lo) {
+                    equal = true;
+                } else if (a.hi < b.lo || b.hi < a.lo) {
+                    equal = false;
+                }
+
+                if (equal && in.op == OpCode::NotEqual) {
+                    equal = !*equal;
+                }
+                r[i] = condition(equal);
+                break;
+            }
+            case OpCode::And: {
+                std::optional<bool> left = truth(a);
+                std::optional<bool> right = truth(b);
+
+                r[i] = condition(left == false || right == false ? std::optional(false) : left && right ? std::optional(true) : std::nullopt);
+                break;
+            }
+            case OpCode::Or: {
+                std::optional<bool> left = truth(a);
+                std::optional<bool> right = truth(b);
+
+                r[i] = condition(left == true || right == true ? std::optional(true) : left && right ? std::optional(false) : std::nullopt);
+                break;
+            }
+            case OpCode::Select: {
+                Interval c = r[in.c];
+
+                if (std::optional<bool> taken = truth(a)) {
+                    r[i] = *taken ? b : c;
+                } else {
+                    // Both branches are possible and the switch between them may jump
+                    r[i] = {std::min(b.lo, c.lo), std::max(b.hi, c.hi), false};
+                }
+                break;
+            }
+            case OpCode::Counter:
+                r[i] = Interval::point(in.value);
+                break;
+            case OpCode::Sum:
+            case OpCode::Product: {
+                // The counter is a single value, the loop runs like in the scalar evaluator
+                double counter = a.lo;
+
+                if (counter == m_instructions[in.a].value) {
+                    r[i] = b;
+                } else if (in.op == OpCode::Sum) {
+                    r[i] = bounds(r[i].lo + b.lo, r[i].hi + b.hi, r[i].continuous && b.continuous);
+                } else {
+                    r[i] = multiply(r[i], b);
+                }
+
+                if (counter < in.value) {
+                    r[in.a] = Interval::point(counter + 1);
+                    i = in.a;
+                }
+                break;
+            }
+            case OpCode::Negate:
+                r[i] = {-a.hi, -a.lo, a.continuous};
+                break;
+            case OpCode::Sin:
+                r[i] = sine(a);
+                break;
+            case OpCode::Cos:
+                // cos(x) = sin(x + pi/2)
+                r[i] = sine({a.lo + std::numbers::pi / 2, a.hi + std::numbers::pi / 2, a.continuous});
+                break;
+            case OpCode::Tan:
+                r[i] = tangent(a);
+                break;
+            case OpCode::Sqrt:
+                // Negative values are defined as 0, so the guard does not jump
+                r[i] = {std::sqrt(std::max(a.lo, 0.0)), std::sqrt(std::max(a.hi, 0.0)), a.continuous};
+                break;
+            case OpCode::Exp:
+                r[i] = {std::exp(a.lo), std::exp(a.hi), a.continuous};
+                break;
+            case OpCode::Log:
+                if (a.lo > 0) {
+                    r[i] = {std::log(a.lo), std::log(a.hi), a.continuous};
+                } else if (a.hi <= 0) {
+                    r[i] = Interval::point(0.0);
+                } else {
+                    // Falls to -inf towards 0 and jumps to the guard value 0 behind it
+                    r[i] = {-std::numeric_limits<double>::infinity(), std::max(0.0, std::log(a.hi)), false};
+                }
+                break;
+            case OpCode::Abs:
+                r[i] = {magnitudeLow(a), magnitudeHigh(a), a.continuous};
+                break;
+            case OpCode::Root:
+                r[i] = a.lo >= 0 ? Interval{std::sqrt(a.lo), std::sqrt(a.hi), a.continuous} : Interval::whole();
+                break;
+        }
+    }
+
+    return r[m_instructions.size() - 1];
+}
+
+std::uint64_t Program::branches(const Context& context) const {
+
+    if (!hasBranches()) {
+        return 0;
+    }
+
+    thread_local std::vector<double> registers;
+
+    if (registers.size() < m_instructions.size()) {
+        registers.resize(m_instructions.size());
+    }
+
+    execute(context, registers.data());
+
+    std::uint64_t pattern = 0;
+    std::size_t bit = 0;
+
+    for (std::size_t i = 0; i < m_instructions.size(); ++i) {
+
+        const Instruction& in = m_instructions[i];
+
+        if (!isCondition(in.op)) {
+            continue;
+        }
+
+        // A select is decided by its condition operand, comparisons by their own result
+        bool taken = (in.op == OpCode::Select ? registers[in.a] : registers[i]) != 0;
+
+        pattern ^= static_cast<std::uint64_t>(taken) << (bit++ % 64);
+    }
+
+    return pattern;
+}
+
+bool Program::hasBranches() const {
+    return std::any_of(m_instructions.begin(), m_instructions.end(), [](const Instruction& in) { return isCondition(in.op); });
+}
+
+Program Program::specialize(const Context& context, std::size_t slot) const {
+
+    Program program;
+
+    if (m_instructions.empty()) {
+        program.emitConstant(0.0);
+        return program;
+    }
+
+    std::vector<double> values(m_instructions.size());
+    execute(context, values.data());
+
+    // varying[i] is set if register i depends on the swept slot
+    std::vector<bool> varying(m_instructions.size(), false);
+
+    // Live loops have a varying result, their whole body runs in the new program
+    std::vector<int> loopDepth(m_instructions.size() + 1, 0);
+
+    for (std::size_t i = 0; i < m_instructions.size(); ++i) {
+
+        const Instruction& in = m_instructions[i];
+
+        if (in.op == OpCode::Constant || in.op == OpCode::Counter) {
+            continue;
+        }
+
+        if (in.op == OpCode::Variable) {
+            varying[i] = in.a == slot;
+        } else if (isReduction(in.op)) {
+            varying[i] = varying[in.b];
+        } else {
+            varying[i] = varying[in.a] || ((isBinary(in.op) || isTernary(in.op)) && varying[in.b]) ||
+                         (isTernary(in.op) && varying[in.c]);
+        }
+
+        if (isReduction(in.op) && varying[i]) {
+            loopDepth[in.a]++;
+            loopDepth[i + 1]--;
+        }
+    }
+
+    // kept[i] is set if instruction i is copied, registers maps it to the new program
+    std::vector<bool> kept(m_instructions.size(), false);
+    std::vector<std::uint32_t> registers(m_instructions.size(), 0);
+
+    // Invariant registers only become constants where a kept instruction reads them
+    auto operand = [&](std::uint32_t index) {
+        return kept[index] ? registers[index] : program.emitConstant(values[index]);
+    };
+
+    int depth = 0;
+
+    for (std::size_t i = 0; i < m_instructions.size(); ++i) {
+
+        const Instruction& in = m_instructions[i];
+        depth += loopDepth[i];
+
+        // Inside a live loop everything but the plain values runs per iteration
+        kept[i] = varying[i] || (depth > 0 && in.op != OpCode::Constant && in.op != OpCode::Variable);
+
+        if (!kept[i]) {
+            continue;
+        }
+
+        if (in.op == OpCode::Variable) {
+            registers[i] = program.emitVariable(slot);
+        } else if (in.op == OpCode::Counter) {
+            registers[i] = program.append(in);
+        } else if (isReduction(in.op)) {
+            registers[i] = program.append({in.op, registers[in.a], operand(in.b), 0, in.value});
+        } else if (isTernary(in.op)) {
+            std::uint32_t a = operand(in.a);
+            std::uint32_t b = operand(in.b);
+            registers[i] = program.emit(in.op, a, b, operand(in.c));
+        } else if (isBinary(in.op)) {
+            std::uint32_t a = operand(in.a);
+            registers[i] = program.emit(in.op, a, operand(in.b));
+        } else {
+            registers[i] = program.emit(in.op, operand(in.a));
+        }
+    }
+
+    program.finish(operand(static_cast<std::uint32_t>(m_instructions.size() - 1)));
+
+    return program;
+}
+
+void Program::execute(const Context& context, double* r) const {
+
+    for (std::size_t i = 0; i < m_instructions.size(); ++i) {
+
+        const Instruction& in = m_instructions[i];
+
+        switch (in.op) {
+            case OpCode::Constant:
+                r[i] = in.value;
+                break;
+            case OpCode::Variable:
+                r[i] = context[in.a];
+                break;
+            case OpCode::Add:
+                r[i] = r[in.a] + r[in.b];
+                break;
+            case OpCode::Subtract:
+                r[i] = r[in.a] - r[in.b];
+                break;
+            case OpCode::Multiply:
+                r[i] = r[in.a] * r[in.b];
+                break;
+            case OpCode::Divide:
+                r[i] = r[in.b] == 0 ? 0.0 : r[in.a] / r[in.b];
+                break;
+            case OpCode::Power:
+                r[i] = std::pow(r[in.a], r[in.b]);
+                break;
+            case OpCode::Min:
+                r[i] = r[in.b] < r[in.a] ? r[in.b] : r[in.a];
+                break;
+            case OpCode::Max:
+                r[i] = r[in.a] < r[in.b] ? r[in.b] : r[in.a];
+                break;
+            case OpCode::Atan2:
+                r[i] = std::atan2(r[in.a], r[in.b]);
+                break;
+            case OpCode::Hypot:
+                r[i] = std::hypot(r[in.a], r[in.b]);
+                break;
+            case OpCode::Less:
+                r[i] = r[in.a] < r[in.b] ? 1.0 : 0.0;
+                break;
+            case OpCode::LessEqual:
+                r[i] = r[in.a] <= r[in.b] ? 1.0 : 0.0;
+                break;
+            case OpCode::Equal:
+                r[i] = r[in.a] == r[in.b] ? 1.0 : 0.0;
+                break;
+            case OpCode::NotEqual:
+                r[i] = r[in.a] != r[in.b] ? 1.0 : 0.0;
+                break;
+            case OpCode::And:
+                r[i] = r[in.a] != 0 && r[in.b] != 0 ? 1.0 : 0.0;
+                break;
+            case OpCode::Or:
+                r[i] = r[in.a] != 0 || r[in.b] != 0 ? 1.0 : 0.0;
+                break;
+            case OpCode::Select:
+                r[i] = r[in.a] != 0 ? r[in.b] : r[in.c];
+                break;
+            case OpCode::Counter:
+                r[i] = in.value;
+                break;
+            case OpCode::Sum:
+            case OpCode::Product: {
+                double counter = r[in.a];
+
+                // The counter still holds its first value in the first iteration
+                if (counter == m_instructions[in.a].value) {
+                    r[i] = r[in.b];
+                } else {
+                    r[i] = in.op == OpCode::Sum ? r[i] + r[in.b] : r[i] * r[in.b];
+                }
+
+                if (counter < in.value) {
+                    r[in.a] = counter + 1;
+                    i = in.a;
+                }
+                break;
+            }
+            case OpCode::Negate:
+                r[i] = -r[in.a];
+                break;
+            case OpCode::Sin:
+                r[i] = std::sin(r[in.a]);
+                break;
+            case OpCode::Cos:
+                r[i] = std::cos(r[in.a]);
+                break;
+            case OpCode::Tan:
+                r[i] = std::tan(r[in.a]);
+                break;
+            case OpCode::Sqrt:
+                r[i] = r[in.a] < 0 ? 0.0 : std::sqrt(r[in.a]);
+                break;
+            case OpCode::Exp:
+                r[i] = std::exp(r[in.a]);
+                break;
+            case OpCode::Log:
+                r[i] = r[in.a] <= 0 ? 0.0 : std::log(r[in.a]);
+                break;
+            case OpCode::Abs:
+                r[i] = std::abs(r[in.a]);
+                break;
+            case OpCode::Root:
+                r[i] = std::sqrt(r[in.a]);
+                break;
+        }
+    }
+}
+
+void Program::executeTangents(const Context& context, std::span<const std::size_t> slots, double* r, double* tangents) const {
+
+    const std::size_t count = slots.size();
+
+    auto t = [&](std::size_t reg) { return tangents + reg * count; };
+
+    // Tangent of register i as the linear combination a * da + b * db of its operands
+    auto chain = [&](std::size_t i, double a, std::size_t operandA, double b = 0.0, std::size_t operandB = 0) {
+        for (std::size_t k = 0; k < count; ++k) {
+            t(i)[k] = a * t(operandA)[k] + (b != 0 ? b * t(operandB)[k] : 0.0);
+        }
+    };
+
+    auto zero = [&](std::size_t i) {
+        std::fill_n(t(i), count, 0.0);
+    };
+
+    for (std::size_t i = 0; i < m_instructions.size(); ++i) {
+
+        const Instruction& in = m_instructions[i];
+        double a = r[in.a];
+        double b = r[in.b];
+
+        switch (in.op) {
+            case OpCode::Constant:
+                r[i] = in.value;
+                zero(i);
+                break;
+            case OpCode::Variable:
+                r[i] = context[in.a];
+                for (std::size_t k = 0; k < count; ++k) {
+                    t(i)[k] = slots[k] == in.a ? 1.0 : 0.0;
+                }
+                break;
+            case OpCode::Add:
+                r[i] = a + b;
+                chain(i, 1.0, in.a, 1.0, in.b);
+                break;
+            case OpCode::Subtract:
+                r[i] = a - b;
+                chain(i, 1.0, in.a, -1.0, in.b);
+                break;
+            case OpCode::Multiply:
+                r[i] = a * b;
+                chain(i, b, in.a, a, in.b);
+                break;
+            case OpCode::Divide:
+                // Guarded like the value, x / 0 is the constant 0
+                if (b == 0) {
+                    r[i] = 0.0;
+                    zero(i);
+                } else {
+                    r[i] = a / b;
+                    chain(i, 1.0 / b, in.a, -r[i] / b, in.b);
+                }
+                break;
+            case OpCode::Power: {
+                r[i] = std::pow(a, b);
+
+                // b a^(b-1) da + a^b ln(a) db, each part only where its operand varies so 0 * inf never appears
+                bool baseVaries = std::any_of(t(in.a), t(in.a) + count, [](double d) { return d != 0; });
+                bool exponentVaries = std::any_of(t(in.b), t(in.b) + count, [](double d) { return d != 0; });
+
+                double da = baseVaries ? b * std::pow(a, b - 1) : 0.0;
+                double db = exponentVaries ? r[i] * std::log(a) : 0.0;
+
+                for (std::size_t k = 0; k < count; ++k) {
+                    t(i)[k] = (da != 0 ? da * t(in.a)[k] : 0.0) + (db != 0 ? db * t(in.b)[k] : 0.0);
+                }
+                break;
+            }
+            case OpCode::Min:
+                r[i] = b < a ? b : a;
+                chain(i, 1.0, b < a ? in.b : in.a);
+                break;
+            case OpCode::Max:
+                r[i] = a < b ? b : a;
+                chain(i, 1.0, a < b ? in.b : in.a);
+                break;
+            case OpCode::Atan2: {
+                r[i] = std::atan2(a, b);
+
+                double norm = a * a + b * b;
+
+                if (norm == 0) {
+                    zero(i);
+                } else {
+                    chain(i, b / norm, in.a, -a / norm, in.b);
+                }
+                break;
+            }
+            case OpCode::Hypot:
+                r[i] = std::hypot(a, b);
+
+                if (r[i] == 0) {
+                    zero(i);
+                } else {
+                    chain(i, a / r[i], in.a, b / r[i], in.b);
+                }
+                break;
+            case OpCode::Less:
+                r[i] = a < b ? 1.0 : 0.0;
+                zero(i);
+                break;
+            case OpCode::LessEqual:
+                r[i] = a <= b ? 1.0 : 0.0;
+                zero(i);
+                break;
+            case OpCode::Equal:
+                r[i] = a == b ? 1.0 : 0.0;
+                zero(i);
+                break;
+            case OpCode::NotEqual:
+                r[i] = a != b ? 1.0 : 0.0;
+                zero(i);
+                break;
+            case OpCode::And:
+                r[i] = a != 0 && b != 0 ? 1.0 : 0.0;
+                zero(i);
+                break;
+            case OpCode::Or:
+                r[i] = a != 0 || b != 0 ? 1.0 : 0.0;
+                zero(i);
+                break;
+            case OpCode::Select:
+                r[i] = a != 0 ? b : r[in.c];
+                chain(i, 1.0, a != 0 ? in.b : in.c);
+                break;
+            case OpCode::Counter:
+                r[i] = in.value;
+                zero(i);
+                break;
+            case OpCode::Sum:
+            case OpCode::Product: {
+                double counter = a;
+
+                if (counter == m_instructions[in.a].value) {
+                    r[i] = b;
+                    chain(i, 1.0, in.b);
+                } else if (in.op == OpCode::Sum) {
+                    r[i] += b;
+                    chain(i, 1.0, i, 1.0, in.b);
+                } else {
+                    // Product rule with the old value of the accumulator
+                    chain(i, b, i, r[i], in.b);
+                    r[i] *= b;
+                }
+
+                if (counter < in.value) {
+                    r[in.a] = counter + 1;
+                    i = in.a;
+                }
+                break;
+            }
+            case OpCode::Negate:
+                r[i] = -a;
+                chain(i, -1.0, in.a);
+                break;
+            case OpCode::Sin:
+                r[i] = std::sin(a);
+                chain(i, std::cos(a), in.a);
+                break;
+            case OpCode::Cos:
+                r[i] = std::cos(a);
+                chain(i, -std::sin(a), in.a);
+                break;
+            case OpCode::Tan:
+                r[i] = std::tan(a);
+                chain(i, 1.0 + r[i] * r[i], in.a);
+                break;
+            case OpCode::Sqrt:
+                // Flat where the guard applies, like the symbolic derivative
+                r[i] = a < 0 ? 0.0 : std::sqrt(a);
+                chain(i, r[i] == 0 ? 0.0 : 0.5 / r[i], in.a);
+                break;
+            case OpCode::Exp:
+                r[i] = std::exp(a);
+                chain(i, r[i], in.a);
+                break;
+            case OpCode::Log:
+                r[i] = a <= 0 ? 0.0 : std::log(a);
+                chain(i, a <= 0 ? 0.0 : 1.0 / a, in.a);
+                break;
+            case OpCode::Abs:
+                r[i] = std::abs(a);
+                chain(i, a > 0 ? 1.0 : a < 0 ? -1.0 : 0.0, in.a);
+                break;
+            case OpCode::Root:
+                r[i] = std::sqrt(a);
+                chain(i, 0.5 / r[i], in.a);
+                break;
+        }
+    }
+}
+
+void Program::evaluateBatch(std::span<const double> xs, std::span<double> ys, const Context& context, std::size_t slot,
+                            simd::Accuracy accuracy) const {
+
+    if (xs.size() != ys.size()) {
+        throw std::invalid_argument("Batch input and output sizes differ");
+    }
+
+    if (m_instructions.empty()) {
+        std::fill(ys.begin(), ys.end(), 0.0);
+        return;
+    }
+
+    const simd::Kernels& kernels = simd::kernels(accuracy);
+
+    // One row of lanes per register (SoA), reused between calls
+    thread_local std::vector<double> lanes;
+
+    if (lanes.size() < m_instructions.size() * batchLanes) {
+        lanes.resize(m_instructions.size() * batchLanes);
+    }
+
+    auto row = [&](std::uint32_t index) { return lanes.data() + index * batchLanes; };
+
+    for (std::size_t offset = 0; offset < xs.size(); offset += batchLanes) {
+
+        std::size_t count = std::min(batchLanes, xs.size() - offset);
+
+        for (std::size_t i = 0; i < m_instructions.size(); ++i) {
+
+            const Instruction& in = m_instructions[i];
+            double* r = row(static_cast<std::uint32_t>(i));
+
+            switch (in.op) {
+                case OpCode::Constant:
+                    simd::fill(in.value, r, count);
+                    break;
+                case OpCode::Variable:
+                    if (in.a == slot) {
+                        std::copy_n(xs.data() + offset, count, r);
+                    } else {
+                        simd::fill(context[in.a], r, count);
+                    }
+                    break;
+                case OpCode::Add:
+                    kernels.add(row(in.a), row(in.b), r, count);
+                    break;
+                case OpCode::Subtract:
+                    kernels.subtract(row(in.a), row(in.b), r, count);
+                    break;
+                case OpCode::Multiply:
+                    kernels.multiply(row(in.a), row(in.b), r, count);
+                    break;
+                case OpCode::Divide:
+                    kernels.divide(row(in.a), row(in.b), r, count);
+                    break;
+                case OpCode::Power:
+                    kernels.power(row(in.a), row(in.b), r, count);
+                    break;
+                case OpCode::Min:
+                    kernels.minimum(row(in.a), row(in.b), r, count);
+                    break;
+                case OpCode::Max:
+                    kernels.maximum(row(in.a), row(in.b), r, count);
+                    break;
+                case OpCode::Atan2:
+                    kernels.atan2(row(in.a), row(in.b), r, count);
+                    break;
+                case OpCode::Hypot:
+                    kernels.hypot(row(in.a), row(in.b), r, count);
+                    break;
+                case OpCode::Less:
+                    kernels.less(row(in.a), row(in.b), r, count);
+                    break;
+                case OpCode::LessEqual:
+                    kernels.lessEqual(row(in.a), row(in.b), r, count);
+                    break;
+                case OpCode::Equal:
+                    kernels.equal(row(in.a), row(in.b), r, count);
+                    break;
+                case OpCode::NotEqual:
+                    kernels.notEqual(row(in.a), row(in.b), r, count);
+                    break;
+                case OpCode::And:
+                    kernels.logicalAnd(row(in.a), row(in.b), r, count);
+                    break;
+                case OpCode::Or:
+                    kernels.logicalOr(row(in.a), row(in.b), r, count);
+                    break;
+                case OpCode::Select:
+                    kernels.select(row(in.a), row(in.b), row(in.c), r, count);
+                    break;
+                case OpCode::Counter:
+                    simd::fill(in.value, r, count);
+                    break;
+                case OpCode::Sum:
+                case OpCode::Product: {
+                    // All lanes run the same iterations, the counter is the same in every lane
+                    double* counter = row(in.a);
+                    double k = counter[0];
+
+                    if (k == m_instructions[in.a].value) {
+                        std::copy_n(row(in.b), count, r);
+                    } else if (in.op == OpCode::Sum) {
+                        kernels.add(r, row(in.b), r, count);
+                    } else {
+                        kernels.multiply(r, row(in.b), r, count);
+                    }
+
+                    if (k < in.value) {
+                        simd::fill(k + 1, counter, count);
+                        i = in.a;
+                    }
+                    break;
+                }
+                case OpCode::Negate:
+                    kernels.negate(row(in.a), r, count);
+                    break;
+                case OpCode::Sin:
+                    kernels.sin(row(in.a), r, count);
+                    break;
+                case OpCode::Cos:
+                    kernels.cos(row(in.a), r, count);
+                    break;
+                case OpCode::Tan:
+                    kernels.tan(row(in.a), r, count);
+                    break;
+                case OpCode::Sqrt:
+                    kernels.sqrt(row(in.a), r, count);
+                    break;
+                case OpCode::Exp:
+                    kernels.exp(row(in.a), r, count);
+                    break;
+                case OpCode::Log:
+                    kernels.log(row(in.a), r, count);
+                    break;
+                case OpCode::Abs:
+                    kernels.abs(row(in.a), r, count);
+                    break;
+                case OpCode::Root:
+                    kernels.root(row(in.a), r, count);
+                    break;
+            }
+        }
+
+        std::copy_n(row(static_cast<std::uint32_t>(m_instructions.size() - 1)), count, ys.data() + offset);
+    }
+}
@@ -0,0 +1,180 @@
+//
+//  Program.hpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#ifndef PROGRAM_HPP
+#define PROGRAM_HPP
+
+#include <cstdint>
+#include <vector>
+#include <span>
+#include <unordered_map>
+#include <utility>
+
+#include "AST.hpp"
+#include "../math/Simd.hpp"
+#include "../math/Interval.hpp"
+#include "../math/Dual.hpp"
+
+
+/// @class Program
+/// @brief Flat instruction stream compiled from an AST.
+/// Every instruction writes exactly one register, the register index is the index of the
+/// instruction itself. Operands always refer to earlier registers, so the whole expression
+/// is evaluated by a single forward pass without recursion or virtual calls.
+/// Instructions are hash-consed while compiling, so structurally identical subtrees of the
+/// AST share one register and the program is a DAG that evaluates every subexpression once.
+/// A series is the only exception to the single forward pass: its Counter opens a loop and its
+/// Sum or Product closes it, the instructions in between run once per term. Loops are non-empty
+/// and properly nested.
+class Program {
+public:
+    enum class OpCode : std::uint8_t {
+        Constant,
+        Variable,
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        Power,
+        Min,
+        Max,
+        Atan2,
+        Hypot,
+        Less,      // Comparisons and logic yield 1 or 0, any value but 0 is true
+        LessEqual,
+        Equal,
+        NotEqual,
+        And,
+        Or,
+        Select,    // a ? b : c, all three operands are evaluated
+        Counter,   // Index of a series, starts at value and is advanced by its reduction
+        Sum,       // Adds register b for every value of counter a up to value, then leaves the loop
+        Product,
+        Negate,
+        Sin,
+        Cos,
+        Tan,
+        Sqrt,
+        Exp,
+        Log,
+        Abs,
+        Root
+    };
+
+    // Number of opcodes, has to follow the last entry of OpCode
+    static constexpr std::size_t opCodeCount = static_cast<std::size_t>(OpCode::Root) + 1;
+
+    struct Instruction {
+        OpCode op;
+        std::uint32_t a = 0;
+        std::uint32_t b = 0;
+        std::uint32_t c = 0; // Only used by Select
+        double value = 0.0;  // Constant, first value of a Counter or last value of a reduction
+    };
+
+    // Number of samples processed per register in evaluateBatch
+    static constexpr std::size_t batchLanes = 128;
+
+public:
+    Program() = default;
+
+    // Anything with a compile(Program&) member, an AST or a static expression
+    template<class Root>
+    void compile(const Root& root) {
+        m_instructions.clear();
+        m_registers.clear();
+
+        finish(root.compile(*this));
+    }
+
+    // Takes over a deserialized instruction stream, throws if it is not a valid program
+    void load(std::vector<Instruction> instructions);
+
+    std::uint32_t emit(OpCode op, std::uint32_t a = 0, std::uint32_t b = 0, std::uint32_t c = 0);
+    std::uint32_t emitConstant(double value);
+    std::uint32_t emitVariable(std::size_t slot);
+
+    // Loop over the integers first..last, inside the term the given slot reads the counter
+    std::uint32_t emitSeries(OpCode reduction, std::size_t slot, double first, double last, const ASTNode& term);
+
+    // Appends the instructions of another program, slots[i] is the register passed for its variable i.
+    // Returns the register of its result, shared subexpressions of both programs end up in one register
+    std::uint32_t splice(const Program& callee, std::span<const std::uint32_t> slots);
+
+    static OpCode opCode(Builtin builtin);
+
+    double evaluate(const Context& context) const;
+
+    // Copy for a sweep over the given slot, everything that does not depend on it is folded
+    // into constants with the values of the context. Evaluated once per sweep, not per sample.
+    Program specialize(const Context& context, std::size_t slot) const;
+
+    // Evaluates the program for every value in xs, which is written to the given slot
+    void evaluateBatch(std::span<const double> xs, std::span<double> ys, const Context& context, std::size_t slot,
+                       simd::Accuracy accuracy = simd::Accuracy::Precise) const;
+
+    // Value and derivative with respect to the given slot in one pass, forward mode with dual numbers
+    Dual evaluateDual(const Context& context, std::size_t slot) const;
+
+    // Value of the program, gradient[i] is its derivative with respect to slots[i]. All derivatives are
+    // carried through the same pass, e.g. the sensitivities to every parameter of a fit. Throws if the
+    // gradient has fewer entries than there are slots
+    double evaluateGradient(const Context& context, std::span<const std::size_t> slots, std::span<double> gradient) const;
+
+    // Bounds of the result while the given slot runs through x, every other slot keeps its value
+    // from the context. Poles, undefined values and undecided comparisons clear the continuous flag
+    Interval evaluateInterval(const Context& context, std::size_t slot, Interval x) const;
+
+    // Bit pattern of all comparisons and selects at the given point. Two points with different
+    // patterns lie on different pieces of a piecewise function. Beyond 64 conditions bits are shared
+    std::uint64_t branches(const Context& context) const;
+    bool hasBranches() const;
+
+    bool empty() const { return m_instructions.empty(); }
+    std::size_t size() const { return m_instructions.size(); }
+
+    const std::vector<Instruction>& getInstructions() const { return m_instructions; }
+
+private:
+    struct InstructionHash {
+        std::size_t operator()(const Instruction& instruction) const;
+    };
+
+    struct InstructionEqual {
+        bool operator()(const Instruction& lhs, const Instruction& rhs) const;
+    };
+
+    static bool isCommutative(OpCode op);
+    static bool isBinary(OpCode op);
+    static bool isTernary(OpCode op);
+    static bool isCondition(OpCode op);
+    static bool isReduction(OpCode op);
+
+    // The result has to be the last register, compiling may have returned an earlier one
+    void finish(std::uint32_t result);
+
+    void execute(const Context& context, double* registers) const;
+
+    // execute with slots.size() tangents per register, tangents[r * slots.size() + k] is d register r / d slots[k]
+    void executeTangents(const Context& context, std::span<const std::size_t> slots, double* registers, double* tangents) const;
+
+    std::uint32_t intern(const Instruction& instruction);
+
+    // Loop instructions are never shared, two series with the same bounds are still two loops
+    std::uint32_t append(const Instruction& instruction);
+
+private:
+    std::vector<Instruction> m_instructions;
+
+    // Register of every distinct instruction, only filled while compiling
+    std::unordered_map<Instruction, std::uint32_t, InstructionHash, InstructionEqual> m_registers;
+
+    // Slots read from a counter while compiling the term of a series, innermost last
+    std::vector<std::pair<std::size_t, std::uint32_t>> m_bound;
+};
+
+#endif // PROGRAM_HPP
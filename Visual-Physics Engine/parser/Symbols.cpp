@@ -0,0 +1,88 @@
+//
+//  Symbols.cpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#include "Symbols.hpp"
+
+#include <array>
+#include <cmath>
+#include <stdexcept>
+
+#include "PerfectHash.hpp"
+
+
+namespace {
+
+    constexpr std::array<std::string_view, 2> constantNames = {
+        "pi",
+        "e"
+    };
+
+    constexpr std::array<double, constantNames.size()> constantValues = {
+        M_PI,
+        M_E
+    };
+
+    constexpr PerfectHash<constantNames.size()> constantHash(constantNames);
+}
+
+
+std::optional<SymbolTable::Symbol> SymbolTable::find(std::string_view name) const {
+
+    if (auto builtin = findBuiltin(name)) {
+        return Symbol{.kind = Kind::Function, .builtin = *builtin};
+    }
+
+    if (auto value = findConstant(name)) {
+        return Symbol{.kind = Kind::Constant, .value = *value};
+    }
+
+    if (m_registered.empty()) {
+        return std::nullopt;
+    }
+
+    if (auto it = m_registered.find(name); it != m_registered.end()) {
+        return it->second;
+    }
+
+    return std::nullopt;
+}
+
+void SymbolTable::registerConstant(const std::string& name, double value) {
+    checkUnused(name);
+
+    m_registered[name] = Symbol{.kind = Kind::Constant, .value = value};
+}
+
+void SymbolTable::registerFunction(const std::string& name, Builtin builtin) {
+    checkUnused(name);
+
+    m_registered[name] = Symbol{.kind = Kind::Function, .builtin = builtin};
+}
+
+void SymbolTable::defineFunction(const std::string& name, std::shared_ptr<const CompiledExpression> function) {
+    checkUnused(name);
+
+    if (auto it = m_registered.find(name); it != m_registered.end() && it->second.kind != Kind::UserFunction) {
+        throw std::runtime_error("Symbol already defined: " + name);
+    }
+
+    m_registered[name] = Symbol{.kind = Kind::UserFunction, .function = std::move(function)};
+}
+
+void SymbolTable::checkUnused(const std::string& name) const {
+    if (findBuiltin(name) || findConstant(name)) {
+        throw std::runtime_error("Symbol already defined: " + name);
+    }
+}
+
+std::optional<double> SymbolTable::findConstant(std::string_view name) {
+    if (auto index = constantHash.find(name)) {
+        return constantValues[*index];
+    }
+
+    return std::nullopt;
+}
@@ -0,0 +1,70 @@
+//
+//  Symbols.hpp
+//  Visual-Physics Engine
+//
+//  Created by Kilian Brecht on 17.10.26.
+//
+
+#ifndef SYMBOLS_HPP
+#define SYMBOLS_HPP
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "Builtins.hpp"
+
+
+struct CompiledExpression;
+
+/// @class SymbolTable
+/// @brief Classifies identifiers as function, constant or variable in constant time.
+/// Builtins and the predefined constants are perfect hashed at compile time, names
+/// registered at runtime go into a hash map. Everything not found is a variable.
+/// User functions are compiled expressions of other functions that calls are resolved to.
+class SymbolTable {
+public:
+    enum class Kind : std::uint8_t {
+        Function,
+        Constant,
+        UserFunction
+    };
+
+    struct Symbol {
+        Kind kind;
+        Builtin builtin = Builtin::Count; // Only set for functions
+        double value = 0.0;               // Only set for constants
+        std::shared_ptr<const CompiledExpression> function = nullptr; // Only set for user functions
+    };
+
+public:
+    SymbolTable() = default;
+
+    std::optional<Symbol> find(std::string_view name) const;
+
+    // Registered names must not shadow builtins or predefined constants
+    void registerConstant(const std::string& name, double value);
+    void registerFunction(const std::string& name, Builtin builtin);
+
+    // Replaces an earlier user function of the same name, calls compiled before keep the old one
+    void defineFunction(const std::string& name, std::shared_ptr<const CompiledExpression> function);
+
+private:
+    void checkUnused(const std::string& name) const;
+
+    static std::optional<double> findConstant(std::string_view name);
+
+private:
+    struct NameHash {
+        using is_transparent = void;
+
+        std::size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+    };
+
+    std::unordered_map<std::string, Symbol, NameHash, std::equal_to<>> m_registered;
+};
+
+#endif // SYMBOLS_HPP
@@ -7,71 +7,185 @@
 
 #include "Tokenizer.hpp"
 
-#include <print>
+#include <cctype>
+#include <cstdlib>
+#include <stdexcept>
 
 
-Tokenizer::Tokenizer(const std::string& text)
+namespace {
+
+    bool isDigit(char c) {
+        return std::isdigit(static_cast<unsigned char>(c));
+    }
+
+    bool isIdentifierStart(char c) {
+        return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    bool isIdentifierPart(char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    bool isSpace(char c) {
+        return std::isspace(static_cast<unsigned char>(c));
+    }
+}
+
+
+Tokenizer::Tokenizer(std::string_view text)
     : m_text(text) {
 }
 
-void Tokenizer::setNewText(const std::string& text) {
+void Tokenizer::setNewText(std::string_view text) {
     m_text = text;
 }
 
 void Tokenizer::tokenize() {
-    eraseWhitespace();
-
-    for(const char& c : m_text) {
-        
-        if (std::isalpha(c)) {
-            
-            m_tokens.push_back(std::make_pair(std::string(1, c), TokenType::Identifier));
-            
-        } else if (m_number.find(c) != std::string::npos) {
-            
-            m_tokens.push_back(std::make_pair(std::string(1, c), TokenType::Number));
-            
-        } else if (m_binaryOperators.find(c) != std::string::npos) {
-            
-            if (c == '+' || c == '-') {
-                m_tokens.push_back(std::make_pair(std::string(1, c), TokenType::BinaryPMOperator));
-            } else if (c == '*' || c == '/') {
-                m_tokens.push_back(std::make_pair(std::string(1, c), TokenType::BinaryMDOperator));
-            } else if (c == '^') {
-                m_tokens.push_back(std::make_pair(std::string(1, c), TokenType::BinaryPowerOperator));
-            }
-            
-        } else if (m_punctuation.find(c) != std::string::npos) {
-            
-            m_tokens.push_back(std::make_pair(std::string(1, c), TokenType::Punctuation));
-            
-        } else if (m_delimiters.find(c) != std::string::npos) {
-            
-            m_tokens.push_back(std::make_pair(std::string(1, c), TokenType::Delimiter));
-            
-        } else if (m_bracketOpen.find(c) != std::string::npos) {
-            
-            m_tokens.push_back(std::make_pair(std::string(1, c), TokenType::BracketOpen));
-            
-        } else if (m_bracketClose.find(c) != std::string::npos) {
-            
-            m_tokens.push_back(std::make_pair(std::string(1, c), TokenType::BracketClose));
-            
+    m_tokens.clear();
+
+    std::size_t position = 0;
+
+    while (position < m_text.size()) {
+
+        char c = m_text[position];
+
+        if (isSpace(c)) {
+
+            position++;
+            continue;
+        }
+
+        std::size_t end = position + 1;
+        TokenType type;
+
+        if (isDigit(c) || (c == '.' && position + 1 < m_text.size() && isDigit(m_text[position + 1]))) {
+
+            end = scanNumber(position);
+            type = TokenType::Number;
+
+        } else if (isIdentifierStart(c)) {
+
+            end = scanIdentifier(position);
+            type = TokenType::Identifier;
+
+        } else if (c == '(') {
+
+            type = TokenType::BracketOpen;
+
+        } else if (c == ')') {
+
+            type = TokenType::BracketClose;
+
+        } else if (m_punctuation.find(c) != std::string_view::npos) {
+
+            type = TokenType::Punctuation;
+
+        } else if (m_delimiters.find(c) != std::string_view::npos) {
+
+            end = scanDelimiter(position);
+            type = TokenType::Delimiter;
+
         } else {
-            
-            m_tokens.push_back(std::make_pair(std::string(1, c), TokenType::Unknown));
-            
+
+            type = operatorType(c);
+        }
+
+        Token token{type, m_text.substr(position, end - position), position};
+
+        if (type == TokenType::Number) {
+            token.value = parseNumber(token.text, position);
         }
+
+        m_tokens.push_back(token);
+
+        position = end;
     }
 }
 
-const std::vector<std::pair<std::string, Tokenizer::TokenType>>& Tokenizer::getTokens() const {
+const std::vector<Tokenizer::Token>& Tokenizer::getTokens() const {
     return m_tokens;
 }
 
-void Tokenizer::eraseWhitespace() {
-    m_text.erase(std::remove_if(m_text.begin(), m_text.end(),
-        [](unsigned char c) {
-            return std::isspace(c);
-        }), m_text.end());
+std::size_t Tokenizer::scanNumber(std::size_t position) const {
+
+    auto digits = [&](std::size_t i) {
+        while (i < m_text.size() && isDigit(m_text[i])) {
+            i++;
+        }
+        return i;
+    };
+
+    std::size_t end = digits(position);
+
+    if (end < m_text.size() && m_text[end] == '.') {
+        end = digits(end + 1);
+    }
+
+    // Exponent, only if digits follow, otherwise the e belongs to the next token
+    if (end < m_text.size() && (m_text[end] == 'e' || m_text[end] == 'E')) {
+
+        std::size_t exponent = end + 1;
+
+        if (exponent < m_text.size() && (m_text[exponent] == '+' || m_text[exponent] == '-')) {
+            exponent++;
+        }
+
+        if (exponent < m_text.size() && isDigit(m_text[exponent])) {
+            end = digits(exponent);
+        }
+    }
+
+    return end;
+}
+
+std::size_t Tokenizer::scanIdentifier(std::size_t position) const {
+    std::size_t end = position + 1;
+
+    while (end < m_text.size() && isIdentifierPart(m_text[end])) {
+        end++;
+    }
+
+    return end;
+}
+
+std::size_t Tokenizer::scanDelimiter(std::size_t position) const {
+
+    char c = m_text[position];
+    char next = position + 1 < m_text.size() ? m_text[position + 1] : '\0';
+
+    // <=, >=, ==, != and &&, ||
+    if ((next == '=' && c != '&' && c != '|') || ((c == '&' || c == '|') && next == c)) {
+        return position + 2;
+    }
+
+    return position + 1;
+}
+
+double Tokenizer::parseNumber(std::string_view text, std::size_t offset) const {
+
+    if (text.size() >= m_maxNumberLength) {
+        throw std::runtime_error("Number too long at " + std::to_string(offset));
+    }
+
+    // strtod needs a terminated string, the copy stays on the stack
+    char buffer[m_maxNumberLength];
+    text.copy(buffer, text.size());
+    buffer[text.size()] = '\0';
+
+    return std::strtod(buffer, nullptr);
+}
+
+Tokenizer::TokenType Tokenizer::operatorType(char c) const {
+    switch (c) {
+        case '+':
+        case '-':
+            return TokenType::BinaryPMOperator;
+        case '*':
+        case '/':
+            return TokenType::BinaryMDOperator;
+        case '^':
+            return TokenType::BinaryPowerOperator;
+        default:
+            return TokenType::Unknown;
+    }
 }
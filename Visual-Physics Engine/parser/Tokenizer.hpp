@@ -9,6 +9,7 @@
 #define TOKENIZER_HPP
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 class Tokenizer {
@@ -29,35 +30,43 @@ public:
         Unknown
     };
 
+    // Whole token as a view into the source text, offset is the position in the source
+    struct Token {
+        TokenType type;
+        std::string_view text;
+        std::size_t offset = 0;
+        double value = 0.0; // Only set for numbers
+    };
+
 public:
     Tokenizer() = default;
 
-    Tokenizer(const std::string& text);
+    // The text is not copied, it has to outlive the tokens
+    Tokenizer(std::string_view text);
 
-    void setNewText(const std::string& text);
+    void setNewText(std::string_view text);
 
     void tokenize();
-    
-    void old();
 
-    const std::vector<std::pair<std::string, TokenType>>& getTokens() const;
+    const std::vector<Token>& getTokens() const;
 
 private:
-    void eraseWhitespace();
+    std::size_t scanNumber(std::size_t position) const;
+    std::size_t scanIdentifier(std::size_t position) const;
+    std::size_t scanDelimiter(std::size_t position) const;
+
+    double parseNumber(std::string_view text, std::size_t offset) const;
+
+    TokenType operatorType(char c) const;
 
 private:
-    std::vector<std::pair<std::string, TokenType>> m_tokens;
-    std::string m_text;
-
-    const std::string m_delimiters = "=<>!&|";
-    const std::string m_number = "0123456789";
-    const std::string m_binaryOperators = "+-*/^";
-    const std::string m_punctuation = ".,";
-    const std::string m_bracketOpen = "(";
-    const std::string m_bracketClose = ")";
-
-    TokenType m_lastToken = TokenType::Unknown;
-    TokenType m_lastLastToken = TokenType::Unknown;
+    // Reused between calls, after the first expression tokenizing does not allocate
+    std::vector<Token> m_tokens;
+    std::string_view m_text;
+
+    static constexpr std::string_view m_delimiters = "=<>!&|";
+    static constexpr std::string_view m_punctuation = ",";
+    static constexpr std::size_t m_maxNumberLength = 64;
 };
 
-#endif
+#endif // TOKENIZER_HPP